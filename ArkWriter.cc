@@ -0,0 +1,158 @@
+/**
+ * Class for writing Kaldi archives of features
+ *
+ * @version $Version: 2026.10.17$
+ * @copyright Copyright (c) 2016-present, Mauricio Villegas <mauricio_ville@yahoo.com>
+ * @license MIT License
+ */
+
+#include "ArkWriter.h"
+#include "quant.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <stdexcept>
+
+using namespace std;
+
+////////////////////
+/// Constructors ///
+////////////////////
+
+/**
+ * ArkWriter constructor.
+ */
+ArkWriter::ArkWriter() {
+  pthread_mutex_init( &mutex, NULL );
+}
+
+/**
+ * ArkWriter destructor, closes the streams if still open.
+ */
+ArkWriter::~ArkWriter() {
+  close();
+  pthread_mutex_destroy( &mutex );
+}
+
+//////////////////////
+/// Open and close ///
+//////////////////////
+
+/**
+ * Opens the ark and scp outputs.
+ *
+ * @param arkfile  File name or pipe for the ark, "-" for stdout.
+ * @param scpfile  File name for the scp, NULL for none.
+ */
+void ArkWriter::open( const char* arkfile, const char* scpfile ) {
+  close();
+  arkname = arkfile;
+  offset = 0;
+
+  ark = strcmp(arkfile,"-") ? fopen( arkfile, "wb" ) : stdout;
+  if( ark == NULL )
+    throw runtime_error( string("ArkWriter: unable to open: ")+arkfile );
+  setvbuf( ark, NULL, _IOFBF, 1<<20 );
+
+  if( scpfile != NULL ) {
+    scp = fopen( scpfile, "w" );
+    if( scp == NULL )
+      throw runtime_error( string("ArkWriter: unable to open: ")+scpfile );
+  }
+}
+
+/**
+ * Flushes and closes the outputs.
+ */
+void ArkWriter::close() {
+  if( ark != NULL ) {
+    if( ark == stdout )
+      fflush( ark );
+    else
+      fclose( ark );
+  }
+  if( scp != NULL )
+    fclose( scp );
+  ark = scp = NULL;
+}
+
+///////////////
+/// Writing ///
+///////////////
+
+/**
+ * Sets the encoding of the records, only FEAT_RAW, FEAT_U16 and FEAT_U8 are
+ * possible since Kaldi has no float16 matrices.
+ */
+void ArkWriter::setEncoding( int _encoding ) {
+  if( _encoding != FEAT_RAW && _encoding != FEAT_U16 && _encoding != FEAT_U8 )
+    throw runtime_error( string("ArkWriter: encoding not supported by Kaldi: ")+featEncodingName(_encoding) );
+  encoding = _encoding;
+}
+
+/**
+ * Serializes a features matrix as a binary Kaldi float matrix record, or as a
+ * compressed matrix (global header: min, range, rows, cols) if quantized.
+ *
+ * @param key       Key (utterance id) of the record, must not contain spaces.
+ * @param feats     Features matrix, one column per frame.
+ * @param encoding  FEAT_RAW, FEAT_U16 for CM2 or FEAT_U8 for CM3.
+ * @return          The record bytes.
+ */
+string ArkWriter::record( const string& key, const cv::Mat& feats, int encoding ) {
+  cv::Mat frames;
+  feats.t().convertTo( frames, CV_32F );
+  int32_t rows = frames.rows;
+  int32_t cols = frames.cols;
+
+  string rec = key;
+  if( encoding == FEAT_U16 || encoding == FEAT_U8 ) {
+    cv::Mat data;
+    float scale, offset;
+    featEncode( frames, data, encoding, &scale, &offset );
+    float range = scale * ( encoding == FEAT_U16 ? 65535.0f : 255.0f );
+    rec.append( encoding == FEAT_U16 ? " \0BCM2 " : " \0BCM3 ", 7 );
+    rec.append( (char*)&offset, 4 );
+    rec.append( (char*)&range, 4 );
+    rec.append( (char*)&rows, 4 );
+    rec.append( (char*)&cols, 4 );
+    for( int r=0; r<rows; r++ )
+      rec.append( (const char*)data.ptr<unsigned char>(r), cols*data.elemSize() );
+    return rec;
+  }
+
+  rec.append( " \0BFM ", 6 );
+  rec.push_back( '\4' );
+  rec.append( (char*)&rows, 4 );
+  rec.push_back( '\4' );
+  rec.append( (char*)&cols, 4 );
+  for( int r=0; r<rows; r++ )
+    rec.append( (const char*)frames.ptr<float>(r), cols*sizeof(float) );
+  return rec;
+}
+
+/**
+ * Writes a serialized record to the ark and its entry to the scp. Thread safe.
+ *
+ * @param rec  Record as given by ArkWriter::record.
+ */
+void ArkWriter::write( const string& rec ) {
+  size_t keylen = rec.find(' ');
+
+  pthread_mutex_lock( &mutex );
+  size_t len = fwrite( rec.data(), 1, rec.size(), ark );
+  if( scp != NULL )
+    fprintf( scp, "%.*s %s:%llu\n", (int)keylen, rec.data(), arkname.c_str(), offset+keylen+1 );
+  offset += len;
+  pthread_mutex_unlock( &mutex );
+
+  if( len != rec.size() )
+    throw runtime_error( "ArkWriter: failed to write to: "+arkname );
+}
+
+/**
+ * Writes a features matrix to the ark. Thread safe.
+ */
+void ArkWriter::write( const string& key, const cv::Mat& feats ) {
+  write( record( key, feats, encoding ) );
+}
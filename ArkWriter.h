@@ -0,0 +1,43 @@
+/**
+ * Header file for the ArkWriter class
+ *
+ * Writes features matrices as a Kaldi binary archive (ark) to a file, a named
+ * pipe or stdout, and optionally the corresponding script (scp) with the byte
+ * offset of each record. Features are stored transposed, i.e. one row per
+ * frame, as Kaldi expects. With the u16 or u8 encodings (see quant.h) records
+ * are Kaldi compressed matrices (CM2 or CM3), which Kaldi tools read directly.
+ *
+ * @version $Version: 2026.10.17$
+ * @copyright Copyright (c) 2016-present, Mauricio Villegas <mauricio_ville@yahoo.com>
+ * @license MIT License
+ */
+
+#ifndef __ARKWRITER_H__
+#define __ARKWRITER_H__
+
+#include <stdio.h>
+#include <pthread.h>
+#include <string>
+
+#include <opencv2/opencv.hpp>
+
+class ArkWriter {
+  public:
+    ArkWriter();
+    ~ArkWriter();
+    void open( const char* arkfile, const char* scpfile = NULL );
+    void close();
+    void setEncoding( int encoding );
+    static std::string record( const std::string& key, const cv::Mat& feats, int encoding = 0 );
+    void write( const std::string& rec );
+    void write( const std::string& key, const cv::Mat& feats );
+  private:
+    FILE *ark = NULL;
+    FILE *scp = NULL;
+    std::string arkname;
+    unsigned long long offset = 0;
+    int encoding = 0;
+    pthread_mutex_t mutex;
+};
+
+#endif
@@ -0,0 +1,491 @@
+/**
+ * Class for in-memory batch extraction of text features, and its C interface
+ *
+ * @version $Version: 2026.10.17$
+ * @copyright Copyright (c) 2016-present, Mauricio Villegas <mauricio_ville@yahoo.com>
+ * @license MIT License
+ */
+
+#include "BatchExtractor.h"
+#include "textFeatsBatch.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdexcept>
+#include <libconfig.h++>
+
+using namespace std;
+using namespace libconfig;
+
+/////////////////////
+/// Class version ///
+/////////////////////
+
+static char class_version[] = "Version: 2026.10.17";
+
+/**
+ * Returns the class version.
+ */
+char* BatchExtractor::version() {
+  return class_version+9;
+}
+
+/////////////////////
+/// Configuration ///
+/////////////////////
+
+/**
+ * BatchExtractor constructor.
+ *
+ * @param cfgfile     Extractor configuration file, NULL for the defaults.
+ * @param numthreads  Number of extraction threads.
+ */
+BatchExtractor::BatchExtractor( const char* cfgfile, int _numthreads ) {
+  if( cfgfile != NULL ) {
+    Config cfg;
+    try {
+      cfg.readFile( cfgfile );
+    } catch( const FileIOException& ) {
+      throw runtime_error( string("BatchExtractor: unable to read config file: ")+cfgfile );
+    } catch( const ParseException& pex ) {
+      throw runtime_error( string("BatchExtractor: parse error in config file at line ")+to_string(pex.getLine())+": "+pex.getError() );
+    }
+    extractor.loadConf( cfg );
+  }
+  setThreads( _numthreads );
+}
+
+/**
+ * Sets the number of extraction threads.
+ */
+void BatchExtractor::setThreads( int _numthreads ) {
+  numthreads = _numthreads < 1 ? 1 : _numthreads ;
+}
+
+/**
+ * Sets whether to compute the features contour and parallelogram of samples.
+ */
+void BatchExtractor::setInfo( bool _info ) {
+  info = _info;
+}
+
+/**
+ * Sets random perturbation of samples. The random generator is seeded for each
+ * sample from the seed and its id, so results do not depend on the threads.
+ */
+void BatchExtractor::setRandom( bool _randomize, uint64_t _seed ) {
+  randomize = _randomize;
+  seed = _seed;
+}
+
+/**
+ * Batch destructor, frees the features buffer unless released.
+ */
+BatchExtractor::Batch::~Batch() {
+  free( data );
+}
+
+/**
+ * Empties the batch, freeing the features buffer.
+ */
+void BatchExtractor::Batch::clear() {
+  free( data );
+  data = NULL;
+  size = 0;
+  dim = maxwidth = 0;
+  padded = false;
+  samples.clear();
+}
+
+/**
+ * Gives up ownership of the features buffer, to be freed with free().
+ */
+float* BatchExtractor::Batch::release() {
+  float* buffer = data;
+  data = NULL;
+  size = 0;
+  return buffer;
+}
+
+//////////////////
+/// Extraction ///
+//////////////////
+
+/**
+ * Extracts features of a batch of line images.
+ *
+ * @param images   Line images, released as they are processed.
+ * @param batch    Set to the batch features.
+ * @param pad      Whether to zero pad all samples to the widest.
+ */
+void BatchExtractor::extract( vector<PageImage>& images, Batch& batch, bool pad ) {
+  vector<NamedImage> lines( images.size() );
+  for( int n=0; n<(int)images.size(); n++ ) {
+    lines[n].id = lines[n].name = to_string(n);
+    lines[n].image = images[n];
+    images[n] = PageImage();
+  }
+  vector<int> xheights( lines.size(), 0 );
+  run( lines, xheights, batch, pad );
+}
+
+/**
+ * Extracts features of the lines of a Page XML selected by an xpath. Page
+ * images are read by loadXml, relative to the current directory for XML strings.
+ *
+ * @param xml        Page XML file name, or the XML itself if xmlstring.
+ * @param xpath      Selector of the TextLine Coords to extract.
+ * @param batch      Set to the batch features.
+ * @param pad        Whether to zero pad all samples to the widest.
+ * @param xmlstring  Whether xml is the XML content instead of a file name.
+ */
+void BatchExtractor::extract( const char* xml, const char* xpath, Batch& batch, bool pad, bool xmlstring ) {
+  PageXML page;
+  if( xmlstring )
+    page.loadXmlString( xml );
+  else
+    page.loadXml( xml );
+  vector<NamedImage> lines = page.crop( xpath, NULL, true );
+  vector<int> xheights( lines.size() );
+  for( int n=0; n<(int)lines.size(); n++ )
+    xheights[n] = page.getXheight( lines[n].id.c_str() );
+  run( lines, xheights, batch, pad );
+}
+
+/**
+ * Shared state of the threads of a batch.
+ */
+struct BatchWork {
+  TextFeatExtractor* extractor;
+  bool info;
+  bool randomize;
+  uint64_t seed;
+  vector<NamedImage>* lines;
+  vector<int>* xheights;
+  vector<cv::Mat> feats;
+  BatchExtractor::Batch* batch;
+  int next;
+  pthread_mutex_t mutex;
+};
+
+/**
+ * Returns the seed of the random generator for a sample, FNV-1a of its id
+ * starting from the batch seed.
+ */
+static uint64_t sample_seed( uint64_t seed, const string& id ) {
+  uint64_t hash = 0xcbf29ce484222325ULL ^ seed;
+  for( size_t n=0; n<id.size(); n++ ) {
+    hash ^= (unsigned char)id[n];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash != 0 ? hash : 1;
+}
+
+/**
+ * Extraction thread, takes the next unprocessed sample until there are none.
+ */
+static void* batchThread( void* _work ) {
+  BatchWork& work = *(BatchWork*)_work;
+
+  while( true ) {
+    pthread_mutex_lock( &work.mutex );
+    int n = work.next++;
+    pthread_mutex_unlock( &work.mutex );
+    if( n >= (int)work.lines->size() )
+      break;
+
+    NamedImage& namedimg = (*work.lines)[n];
+    BatchExtractor::Sample& sample = work.batch->samples[n];
+    sample.id = namedimg.id;
+    sample.rotation = namedimg.rotation;
+
+    try {
+      if( work.randomize )
+        cv::theRNG().state = sample_seed( work.seed, namedimg.id );
+
+      PageImage image = namedimg.image;
+      namedimg.image = PageImage();
+      work.extractor->preprocess( image, work.info ? &sample.fcontour : NULL, work.randomize );
+      work.extractor->estimateAngles( image, &sample.slope, &sample.slant, namedimg.rotation );
+      cv::Mat feats = work.extractor->extractFeats( image, sample.slope, sample.slant, (*work.xheights)[n], work.info ? &sample.fpgram : NULL, work.randomize, namedimg.rotation, namedimg.direction );
+
+      /// Frames as rows of floats, as for Kaldi ark ///
+      feats.t().convertTo( work.feats[n], CV_32F );
+      sample.width = work.feats[n].rows;
+      sample.ok = true;
+    } catch( const std::exception& e ) {
+      sample.error = e.what();
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Extracts features of a set of lines on the thread pool and packs them.
+ */
+void BatchExtractor::run( vector<NamedImage>& lines, vector<int>& xheights, Batch& batch, bool pad ) {
+  int num = lines.size();
+  batch.clear();
+  batch.samples.resize( num );
+
+  BatchWork work;
+  work.extractor = &extractor;
+  work.info = info;
+  work.randomize = randomize;
+  work.seed = seed;
+  work.lines = &lines;
+  work.xheights = &xheights;
+  work.feats.resize( num );
+  work.batch = &batch;
+  work.next = 0;
+  pthread_mutex_init( &work.mutex, NULL );
+
+  /// Run extraction threads ///
+  int T = numthreads < num ? numthreads : num ;
+  vector<pthread_t> threads( T > 1 ? T-1 : 0 );
+  int created = 0;
+  while( created < (int)threads.size() && pthread_create( &threads[created], NULL, batchThread, &work ) == 0 )
+    created++;
+  batchThread( &work );
+  for( int t=0; t<created; t++ )
+    pthread_join( threads[t], NULL );
+  pthread_mutex_destroy( &work.mutex );
+
+  /// Check dimensionality and get maximum width ///
+  size_t total = 0;
+  for( int n=0; n<num; n++ ) {
+    Sample& sample = batch.samples[n];
+    if( ! sample.ok )
+      continue;
+    int dim = work.feats[n].cols;
+    if( batch.dim == 0 )
+      batch.dim = dim;
+    else if( dim != batch.dim ) {
+      sample.ok = false;
+      sample.error = "unexpected feature dimensionality "+to_string(dim)+" expected "+to_string(batch.dim);
+      continue;
+    }
+    if( sample.width > batch.maxwidth )
+      batch.maxwidth = sample.width;
+    total += sample.width;
+  }
+
+  /// Pack features in a single buffer, zeroed for the padding ///
+  batch.padded = pad;
+  batch.size = pad ? (size_t)num*batch.maxwidth*batch.dim : total*batch.dim ;
+  batch.data = (float*)calloc( batch.size > 0 ? batch.size : 1, sizeof(float) );
+  if( batch.data == NULL )
+    throw runtime_error( "BatchExtractor: unable to allocate features buffer" );
+  size_t offset = 0;
+  for( int n=0; n<num; n++ ) {
+    Sample& sample = batch.samples[n];
+    sample.offset = pad ? (size_t)n*batch.maxwidth*batch.dim : offset ;
+    if( ! sample.ok ) {
+      sample.width = 0;
+      continue;
+    }
+    cv::Mat& frames = work.feats[n];
+    for( int r=0; r<frames.rows; r++ )
+      memcpy( batch.data+sample.offset+(size_t)r*batch.dim, frames.ptr<float>(r), batch.dim*sizeof(float) );
+    offset += (size_t)sample.width*batch.dim;
+    frames.release();
+  }
+}
+
+///////////////////
+/// C interface ///
+///////////////////
+
+struct tf_extractor {
+  BatchExtractor* batch;
+};
+
+static __thread char tf_error[1024] = "";
+
+static int tf_fail( const char* msg ) {
+  snprintf( tf_error, sizeof(tf_error), "%s", msg );
+  return -1;
+}
+
+/**
+ * Fills a C batch from a C++ batch, taking ownership of its features buffer.
+ */
+static void tf_batch_fill( BatchExtractor::Batch& src, tf_batch* batch ) {
+  int num = src.samples.size();
+  memset( batch, 0, sizeof(tf_batch) );
+  batch->num = num;
+  batch->dim = src.dim;
+  batch->maxwidth = src.maxwidth;
+  batch->padded = src.padded;
+  batch->data = src.release();
+  batch->offsets = (long*)calloc( num+1, sizeof(long) );
+  batch->widths = (int*)calloc( num+1, sizeof(int) );
+  batch->ok = (int*)calloc( num+1, sizeof(int) );
+  batch->ids = (char**)calloc( num+1, sizeof(char*) );
+  batch->slopes = (float*)calloc( num+1, sizeof(float) );
+  batch->slants = (float*)calloc( num+1, sizeof(float) );
+  batch->fpgrams = (float*)calloc( 8*num+1, sizeof(float) );
+  batch->contour_offsets = (int*)calloc( num+1, sizeof(int) );
+
+  size_t npoints = 0;
+  for( int n=0; n<num; n++ )
+    npoints += src.samples[n].fcontour.size();
+  batch->contours = (int*)calloc( 2*npoints+1, sizeof(int) );
+
+  int point = 0;
+  for( int n=0; n<num; n++ ) {
+    BatchExtractor::Sample& sample = src.samples[n];
+    batch->offsets[n] = sample.offset;
+    batch->widths[n] = sample.width;
+    batch->ok[n] = sample.ok;
+    batch->ids[n] = strdup( sample.id.c_str() );
+    batch->slopes[n] = sample.slope;
+    batch->slants[n] = sample.slant;
+    for( int k=0; k<(int)sample.fpgram.size() && k<4; k++ ) {
+      batch->fpgrams[8*n+2*k] = sample.fpgram[k].x;
+      batch->fpgrams[8*n+2*k+1] = sample.fpgram[k].y;
+    }
+    batch->contour_offsets[n] = point;
+    for( int k=0; k<(int)sample.fcontour.size(); k++, point++ ) {
+      batch->contours[2*point] = sample.fcontour[k].x;
+      batch->contours[2*point+1] = sample.fcontour[k].y;
+    }
+  }
+  batch->contour_offsets[num] = point;
+}
+
+/**
+ * Returns the reason of the last failure in the calling thread.
+ */
+const char* tf_last_error( void ) {
+  return tf_error;
+}
+
+/**
+ * Creates an extractor, NULL on failure.
+ *
+ * @param cfgfile   Extractor configuration file, NULL for the defaults.
+ * @param threads   Number of extraction threads.
+ */
+tf_extractor* tf_create( const char* cfgfile, int threads ) {
+  try {
+    tf_extractor* tf = new tf_extractor;
+    tf->batch = new BatchExtractor( cfgfile, threads );
+    return tf;
+  } catch( const std::exception& e ) {
+    tf_fail( e.what() );
+    return NULL;
+  }
+}
+
+/**
+ * Releases an extractor.
+ */
+void tf_destroy( tf_extractor* tf ) {
+  if( tf == NULL )
+    return;
+  delete tf->batch;
+  delete tf;
+}
+
+/**
+ * Sets whether to compute features contours and parallelograms.
+ */
+int tf_set_info( tf_extractor* tf, int info ) {
+  if( tf == NULL )
+    return tf_fail( "tf_set_info: null extractor" );
+  tf->batch->setInfo( info );
+  return 0;
+}
+
+/**
+ * Sets random perturbation of samples and its seed.
+ */
+int tf_set_random( tf_extractor* tf, int randomize, unsigned long long seed ) {
+  if( tf == NULL )
+    return tf_fail( "tf_set_random: null extractor" );
+  tf->batch->setRandom( randomize, seed );
+  return 0;
+}
+
+/**
+ * Extracts features of a batch of 8-bit grayscale line images.
+ *
+ * @param num      Number of images.
+ * @param pixels   Pixels of each image, rows of strides[n] bytes.
+ * @param widths   Width of each image.
+ * @param heights  Height of each image.
+ * @param strides  Bytes per row of each image, NULL if equal to the widths.
+ * @param pad      Whether to zero pad all samples to the widest.
+ * @param batch    Set to the batch features.
+ */
+int tf_extract_gray( tf_extractor* tf, int num, const unsigned char** pixels, const int* widths, const int* heights, const int* strides, int pad, tf_batch* batch ) {
+  if( tf == NULL || batch == NULL || num < 0 || ( num > 0 && ( pixels == NULL || widths == NULL || heights == NULL ) ) )
+    return tf_fail( "tf_extract_gray: invalid arguments" );
+  try {
+    vector<PageImage> images( num );
+    for( int n=0; n<num; n++ ) {
+      int stride = strides != NULL ? strides[n] : widths[n] ;
+#if defined (__PAGEXML_IMG_MAGICK__)
+      vector<unsigned char> data( (size_t)widths[n]*heights[n] );
+      for( int y=0; y<heights[n]; y++ )
+        memcpy( data.data()+(size_t)y*widths[n], pixels[n]+(size_t)y*stride, widths[n] );
+      images[n] = Magick::Image( widths[n], heights[n], "I", Magick::CharPixel, data.data() );
+#elif defined (__PAGEXML_IMG_CV__)
+      images[n] = cv::Mat( heights[n], widths[n], CV_8UC1, (void*)pixels[n], stride ).clone();
+#endif
+    }
+    BatchExtractor::Batch result;
+    tf->batch->extract( images, result, pad );
+    tf_batch_fill( result, batch );
+  } catch( const std::exception& e ) {
+    return tf_fail( e.what() );
+  }
+  return 0;
+}
+
+/**
+ * Extracts features of the lines of a Page XML selected by an xpath.
+ *
+ * @param xml        Page XML file name, or the XML itself if xmlstring.
+ * @param xpath      Selector of the Coords to extract, e.g. "//_:TextLine/_:Coords".
+ * @param xmlstring  Whether xml is the XML content instead of a file name.
+ * @param pad        Whether to zero pad all samples to the widest.
+ * @param batch      Set to the batch features.
+ */
+int tf_extract_page( tf_extractor* tf, const char* xml, const char* xpath, int xmlstring, int pad, tf_batch* batch ) {
+  if( tf == NULL || xml == NULL || xpath == NULL || batch == NULL )
+    return tf_fail( "tf_extract_page: invalid arguments" );
+  try {
+    BatchExtractor::Batch result;
+    tf->batch->extract( xml, xpath, result, pad, xmlstring );
+    tf_batch_fill( result, batch );
+  } catch( const std::exception& e ) {
+    return tf_fail( e.what() );
+  }
+  return 0;
+}
+
+/**
+ * Releases the buffers of a batch.
+ */
+void tf_batch_free( tf_batch* batch ) {
+  if( batch == NULL )
+    return;
+  if( batch->ids != NULL )
+    for( int n=0; n<batch->num; n++ )
+      free( batch->ids[n] );
+  free( batch->data );
+  free( batch->offsets );
+  free( batch->widths );
+  free( batch->ok );
+  free( batch->ids );
+  free( batch->slopes );
+  free( batch->slants );
+  free( batch->fpgrams );
+  free( batch->contour_offsets );
+  free( batch->contours );
+  memset( batch, 0, sizeof(tf_batch) );
+}
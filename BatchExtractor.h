@@ -0,0 +1,80 @@
+/**
+ * Header file for the BatchExtractor class
+ *
+ * In-memory extraction of a batch of line images, or of the lines of a Page XML
+ * selected by an xpath, on an internal pool of threads. The result is a single
+ * contiguous float buffer, samples one after the other and each stored frame
+ * by frame (one row of dim values per frame), optionally zero padded to the
+ * widest sample, together with the width and extraction information of each
+ * sample. No files are written. A C interface is in textFeatsBatch.h.
+ *
+ * @version $Version: 2026.10.17$
+ * @copyright Copyright (c) 2016-present, Mauricio Villegas <mauricio_ville@yahoo.com>
+ * @license MIT License
+ */
+
+#ifndef __BATCHEXTRACTOR_H__
+#define __BATCHEXTRACTOR_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "TextFeatExtractor.h"
+#include "PageXML.h"
+
+class BatchExtractor {
+  public:
+
+    /**
+     * Extraction result and information of a sample of a batch.
+     */
+    struct Sample {
+      std::string id;                  // Line id, or index for images
+      bool ok = false;                 // Whether extraction succeeded
+      std::string error;               // Error message if it failed
+      int width = 0;                   // Number of frames
+      size_t offset = 0;               // Offset of the first frame in the buffer, in floats
+      float slope = 0.0;
+      float slant = 0.0;
+      float rotation = 0.0;
+      std::vector<cv::Point> fcontour;
+      std::vector<cv::Point2f> fpgram;
+    };
+
+    /**
+     * Features of a batch. The buffer is allocated with malloc so that it can be
+     * handed over without copying, e.g. to the C interface.
+     */
+    struct Batch {
+      int dim = 0;                     // Feature vector dimensionality
+      int maxwidth = 0;                // Frames of the widest sample
+      bool padded = false;             // Whether samples are padded to maxwidth
+      float* data = NULL;              // Features of all samples
+      size_t size = 0;                 // Number of floats in data
+      std::vector<Sample> samples;
+      Batch() {}
+      Batch( const Batch& ) = delete;
+      Batch& operator=( const Batch& ) = delete;
+      ~Batch();
+      void clear();
+      float* release();
+    };
+
+    BatchExtractor( const char* cfgfile = NULL, int numthreads = 1 );
+    static char* version();
+    void setThreads( int numthreads );
+    void setInfo( bool info );
+    void setRandom( bool randomize, uint64_t seed = 0 );
+    void extract( std::vector<PageImage>& images, Batch& batch, bool pad = true );
+    void extract( const char* xml, const char* xpath, Batch& batch, bool pad = true, bool xmlstring = false );
+  private:
+    TextFeatExtractor extractor;
+    int numthreads = 1;
+    bool info = false;
+    bool randomize = false;
+    uint64_t seed = 0;
+    void run( std::vector<NamedImage>& lines, std::vector<int>& xheights, Batch& batch, bool pad );
+};
+
+#endif
@@ -0,0 +1,452 @@
+/**
+ * Class for archives of feature matrices
+ *
+ * @version $Version: 2026.10.17$
+ * @copyright Copyright (c) 2016-present, Mauricio Villegas <mauricio_ville@yahoo.com>
+ * @license MIT License
+ */
+
+#include "FeatArchive.h"
+#include "quant.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <stdexcept>
+
+using namespace std;
+
+/////////////////////
+/// Class version ///
+/////////////////////
+
+static char class_version[] = "Version: 2026.10.17";
+
+/**
+ * Returns the class version.
+ */
+char* FeatArchive::version() {
+  return class_version+9;
+}
+
+/////////////////
+/// Constants ///
+/////////////////
+
+static const char RECORD_MAGIC[4] = { 'T', 'F', 'A', 'R' };
+static const char SKIP_MAGIC[4] = { 'T', 'F', 'A', 'S' };
+static const char INDEX_MAGIC[8] = { 'T', 'F', 'A', 'I', 'N', 'D', 'E', 'X' };
+static const uint64_t HEADER_SIZE = 32;
+static const uint64_t FOOTER_SIZE = 24;
+static const uint64_t QUANT_SIZE = 16;
+
+struct RecordHeader {
+  char magic[4];
+  uint32_t keylen;
+  int32_t rows;
+  int32_t cols;
+  int32_t type;
+  uint32_t encoding;
+  uint64_t datalen;
+};
+
+inline uint64_t pad16( uint64_t size ) {
+  return ( size + 15 ) & ~(uint64_t)15;
+}
+
+/**
+ * Writes a full buffer at a given offset of a file descriptor.
+ */
+static void pwrite_all( int fd, const char* buf, uint64_t size, uint64_t offset ) {
+  while( size > 0 ) {
+    ssize_t len = pwrite( fd, buf, size, offset );
+    if( len < 0 )
+      throw runtime_error( string("FeatArchive: write failed: ")+strerror(errno) );
+    buf += len;
+    size -= len;
+    offset += len;
+  }
+}
+
+/**
+ * Checks that a record header is consistent and that its data is within a limit.
+ *
+ * @param head     Record header.
+ * @param offset   Offset of the record.
+ * @param limit    Offset up to which the record has to be.
+ * @return         Size of the record, 0 if it is not valid.
+ */
+static uint64_t record_size( const RecordHeader& head, uint64_t offset, uint64_t limit ) {
+  if( memcmp(head.magic,RECORD_MAGIC,4) ||
+      head.rows < 0 || head.cols < 0 || head.type < 0 ||
+      CV_MAT_DEPTH(head.type) > CV_64F || CV_MAT_CN(head.type) > 4 ||
+      head.encoding > FEAT_U8 || head.keylen > limit || head.datalen > limit )
+    return 0;
+  uint64_t prefix = head.encoding == FEAT_RAW ? 0 : QUANT_SIZE ;
+  uint64_t elemsize = CV_ELEM_SIZE(head.type);
+  if( head.datalen < prefix || (uint64_t)head.rows*head.cols != ( head.datalen - prefix ) / elemsize ||
+      ( head.datalen - prefix ) % elemsize != 0 )
+    return 0;
+  uint64_t recsize = HEADER_SIZE + pad16(head.keylen) + pad16(head.datalen);
+  return offset + recsize <= limit ? recsize : 0 ;
+}
+
+////////////////////
+/// Constructors ///
+////////////////////
+
+/**
+ * FeatArchive constructor.
+ */
+FeatArchive::FeatArchive() {
+  pthread_mutex_init( &mutex, NULL );
+}
+
+/**
+ * FeatArchive destructor, closes the archive if still open.
+ */
+FeatArchive::~FeatArchive() {
+  try {
+    close();
+  } catch( const std::exception& e ) {
+  }
+  pthread_mutex_destroy( &mutex );
+}
+
+//////////////////////
+/// Open and close ///
+//////////////////////
+
+/**
+ * Scans the records of an archive adding them to the index. Later records of
+ * a key replace earlier ones, and records of failed writes are skipped.
+ *
+ * @param data   Archive data.
+ * @param size   Size of the data.
+ * @return       Offset after the last complete record.
+ */
+uint64_t FeatArchive::scan( const char* data, uint64_t size ) {
+  uint64_t offset = 0;
+  while( offset+HEADER_SIZE <= size ) {
+    RecordHeader head;
+    memcpy( &head, data+offset, HEADER_SIZE );
+    if( ! memcmp(head.magic,SKIP_MAGIC,4) && head.datalen % 16 == 0 && offset+HEADER_SIZE+head.datalen <= size ) {
+      offset += HEADER_SIZE + head.datalen;
+      continue;
+    }
+    uint64_t recsize = record_size( head, offset, size );
+    if( recsize == 0 )
+      break;
+    Entry entry = { offset, head.rows, head.cols, head.type, offset+HEADER_SIZE+pad16(head.keylen), head.encoding };
+    index[string(data+offset+HEADER_SIZE,head.keylen)] = entry;
+    offset += recsize;
+  }
+  return offset;
+}
+
+/**
+ * Loads the index at the end of an archive.
+ *
+ * @param data          Archive data.
+ * @param size          Size of the data.
+ * @param index_offset  Set to the offset at which the index starts.
+ * @return              Whether a valid index was found.
+ */
+bool FeatArchive::loadIndex( const char* data, uint64_t size, uint64_t* index_offset ) {
+  if( size < FOOTER_SIZE || memcmp(data+size-8,INDEX_MAGIC,8) )
+    return false;
+  uint64_t offset, num;
+  memcpy( &offset, data+size-FOOTER_SIZE, 8 );
+  memcpy( &num, data+size-FOOTER_SIZE+8, 8 );
+  if( offset > size-FOOTER_SIZE )
+    return false;
+
+  uint64_t pos = offset;
+  for( uint64_t n=0; n<num; n++ ) {
+    if( pos+12 > size-FOOTER_SIZE )
+      return false;
+    uint64_t recoffset;
+    uint32_t keylen;
+    memcpy( &recoffset, data+pos, 8 );
+    memcpy( &keylen, data+pos+8, 4 );
+    if( pos+12+keylen > size-FOOTER_SIZE || recoffset+HEADER_SIZE > offset )
+      return false;
+    RecordHeader head;
+    memcpy( &head, data+recoffset, HEADER_SIZE );
+    if( record_size( head, recoffset, offset ) == 0 || head.keylen != keylen ||
+        memcmp( data+recoffset+HEADER_SIZE, data+pos+12, keylen ) )
+      return false;
+    Entry entry = { recoffset, head.rows, head.cols, head.type, recoffset+HEADER_SIZE+pad16(head.keylen), head.encoding };
+    index[string(data+pos+12,keylen)] = entry;
+    pos += 12+keylen;
+  }
+
+  *index_offset = offset;
+  return true;
+}
+
+/**
+ * Opens an archive for writing.
+ *
+ * @param fname   File name of the archive.
+ * @param append  Whether to append to an existing archive, otherwise it is truncated.
+ */
+void FeatArchive::open( const char* _fname, bool append ) {
+  close();
+  fname = _fname;
+  readonly = false;
+
+  fd = ::open( _fname, O_RDWR | O_CREAT | ( append ? 0 : O_TRUNC ), 0644 );
+  if( fd < 0 )
+    throw runtime_error( string("FeatArchive: unable to open: ")+fname );
+
+  /// Recover index of existing archive and drop its trailer ///
+  struct stat st;
+  fstat( fd, &st );
+  end = 0;
+  if( st.st_size > 0 ) {
+    char *data = (char*)mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    if( data == MAP_FAILED )
+      throw runtime_error( string("FeatArchive: unable to map: ")+fname );
+    if( ! loadIndex( data, st.st_size, &end ) ) {
+      index.clear();
+      end = scan( data, st.st_size );
+    }
+    munmap( data, st.st_size );
+    if( ftruncate( fd, end ) )
+      throw runtime_error( string("FeatArchive: unable to truncate: ")+fname );
+  }
+}
+
+/**
+ * Opens an archive for reading by memory mapping it.
+ *
+ * @param fname   File name of the archive.
+ */
+void FeatArchive::openRead( const char* _fname ) {
+  close();
+  fname = _fname;
+  readonly = true;
+
+  fd = ::open( _fname, O_RDONLY );
+  if( fd < 0 )
+    throw runtime_error( string("FeatArchive: unable to open: ")+fname );
+
+  struct stat st;
+  fstat( fd, &st );
+  mapsize = st.st_size;
+  if( mapsize > 0 ) {
+    map = (char*)mmap( NULL, mapsize, PROT_READ, MAP_SHARED, fd, 0 );
+    if( map == MAP_FAILED ) {
+      map = NULL;
+      throw runtime_error( string("FeatArchive: unable to map: ")+fname );
+    }
+    if( ! loadIndex( map, mapsize, &end ) ) {
+      index.clear();
+      end = scan( map, mapsize );
+    }
+  }
+}
+
+/**
+ * Closes the archive, writing the index if opened for writing.
+ */
+void FeatArchive::close() {
+  if( fd < 0 )
+    return;
+
+  if( ! readonly ) {
+    string trailer;
+    for( std::map<string,Entry>::iterator it=index.begin(); it!=index.end(); it++ ) {
+      uint32_t keylen = it->first.size();
+      trailer.append( (char*)&it->second.offset, 8 );
+      trailer.append( (char*)&keylen, 4 );
+      trailer.append( it->first );
+    }
+    uint64_t num = index.size();
+    trailer.append( (char*)&end, 8 );
+    trailer.append( (char*)&num, 8 );
+    trailer.append( INDEX_MAGIC, 8 );
+    pwrite_all( fd, trailer.data(), trailer.size(), end );
+  }
+
+  if( map != NULL )
+    munmap( map, mapsize );
+  ::close( fd );
+  fd = -1;
+  map = NULL;
+  mapsize = 0;
+  end = 0;
+  index.clear();
+}
+
+/**
+ * Returns whether the archive is open.
+ */
+bool FeatArchive::isOpen() {
+  return fd >= 0;
+}
+
+/**
+ * Sets the encoding of subsequently written matrices. Only single channel
+ * floating point matrices are encoded, others are always stored as is.
+ *
+ * @param encoding   One of the FeatEncoding values.
+ */
+void FeatArchive::setEncoding( int _encoding ) {
+  if( _encoding < FEAT_RAW || _encoding > FEAT_U8 )
+    throw runtime_error( "FeatArchive: unknown encoding" );
+  encoding = _encoding;
+}
+
+/**
+ * Returns the file name of the archive.
+ */
+const string& FeatArchive::getFilename() {
+  return fname;
+}
+
+//////////////////////
+/// Read and write ///
+//////////////////////
+
+/**
+ * Checks whether the archive has a record for a key.
+ */
+bool FeatArchive::contains( const string& key ) {
+  pthread_mutex_lock( &mutex );
+  bool found = index.find(key) != index.end();
+  pthread_mutex_unlock( &mutex );
+  return found;
+}
+
+/**
+ * Appends a features matrix to the archive. Thread safe, the space of the
+ * record is reserved while locked and then written without locking. If the
+ * key is already in the archive, e.g. when appending a rerun, the new record
+ * replaces it. If writing fails the record is marked to be skipped.
+ *
+ * @param key    Key of the record.
+ * @param feats  Features matrix.
+ */
+void FeatArchive::write( const string& key, const cv::Mat& feats ) {
+  if( fd < 0 || readonly )
+    throw runtime_error( "FeatArchive: archive not open for writing" );
+
+  /// Encode floating point features ///
+  int enc = FEAT_RAW;
+  char quant[QUANT_SIZE] = { 0 };
+  cv::Mat data = feats;
+  if( encoding != FEAT_RAW && feats.channels() == 1 && ( feats.depth() == CV_32F || feats.depth() == CV_64F ) ) {
+    float scale, offset;
+    enc = encoding;
+    featEncode( feats, data, enc, &scale, &offset );
+    memcpy( quant, &scale, 4 );
+    memcpy( quant+4, &offset, 4 );
+  }
+  if( ! data.isContinuous() )
+    data = data.clone();
+  uint64_t prefix = enc == FEAT_RAW ? 0 : QUANT_SIZE ;
+  uint64_t datalen = prefix + data.total()*data.elemSize();
+  uint64_t keypad = pad16(key.size());
+  uint64_t recsize = HEADER_SIZE + keypad + pad16(datalen);
+
+  /// Reserve space for the record ///
+  pthread_mutex_lock( &mutex );
+  uint64_t offset = end;
+  end += recsize;
+  Entry entry = { offset, data.rows, data.cols, data.type(), offset+HEADER_SIZE+keypad, (uint32_t)enc };
+  std::map<string,Entry>::iterator prev = index.find(key);
+  bool replaced = prev != index.end();
+  Entry previous = replaced ? prev->second : entry ;
+  index[key] = entry;
+  pthread_mutex_unlock( &mutex );
+
+  /// Write the record ///
+  string head( HEADER_SIZE+keypad, '\0' );
+  RecordHeader header;
+  memcpy( header.magic, RECORD_MAGIC, 4 );
+  header.keylen = key.size();
+  header.rows = data.rows;
+  header.cols = data.cols;
+  header.type = data.type();
+  header.encoding = enc;
+  header.datalen = datalen;
+  memcpy( &head[0], &header, HEADER_SIZE );
+  memcpy( &head[HEADER_SIZE], key.data(), key.size() );
+  try {
+    pwrite_all( fd, head.data(), head.size(), offset );
+    if( prefix > 0 )
+      pwrite_all( fd, quant, prefix, offset+head.size() );
+    pwrite_all( fd, (const char*)data.data, datalen-prefix, offset+head.size()+prefix );
+    if( pad16(datalen) > datalen ) {
+      char zeros[16] = { 0 };
+      pwrite_all( fd, zeros, pad16(datalen)-datalen, offset+head.size()+datalen );
+    }
+  }
+
+  /// On failure restore the index and mark the reserved space to be skipped ///
+  catch( const std::exception& ) {
+    pthread_mutex_lock( &mutex );
+    std::map<string,Entry>::iterator it = index.find(key);
+    if( it != index.end() && it->second.offset == offset ) {
+      if( replaced )
+        it->second = previous;
+      else
+        index.erase( it );
+    }
+    pthread_mutex_unlock( &mutex );
+    RecordHeader skip;
+    memset( &skip, 0, HEADER_SIZE );
+    memcpy( skip.magic, SKIP_MAGIC, 4 );
+    skip.datalen = recsize - HEADER_SIZE;
+    try {
+      pwrite_all( fd, (const char*)&skip, HEADER_SIZE, offset );
+    } catch( const std::exception& ) {
+    }
+    throw;
+  }
+}
+
+/**
+ * Gets a features matrix from an archive opened for reading. Matrices stored
+ * as is reference the mapped memory, so they are only valid while the archive
+ * is open; encoded ones are decoded into newly allocated floats.
+ *
+ * @param key    Key of the record.
+ * @param feats  Matrix set to the features.
+ * @return       Whether the key was found.
+ */
+bool FeatArchive::read( const string& key, cv::Mat& feats ) {
+  if( map == NULL )
+    throw runtime_error( "FeatArchive: archive not open for reading" );
+  std::map<string,Entry>::iterator it = index.find(key);
+  if( it == index.end() )
+    return false;
+  Entry& entry = it->second;
+  if( entry.encoding == FEAT_RAW ) {
+    feats = cv::Mat( entry.rows, entry.cols, entry.type, map+entry.dataoffset );
+    return true;
+  }
+  float scale, offset;
+  memcpy( &scale, map+entry.dataoffset, 4 );
+  memcpy( &offset, map+entry.dataoffset+4, 4 );
+  cv::Mat data( entry.rows, entry.cols, entry.type, map+entry.dataoffset+QUANT_SIZE );
+  featDecode( data, feats, entry.encoding, scale, offset );
+  return true;
+}
+
+/**
+ * Returns the keys of all records in the archive.
+ */
+vector<string> FeatArchive::keys() {
+  vector<string> keys;
+  pthread_mutex_lock( &mutex );
+  for( std::map<string,Entry>::iterator it=index.begin(); it!=index.end(); it++ )
+    keys.push_back(it->first);
+  pthread_mutex_unlock( &mutex );
+  return keys;
+}
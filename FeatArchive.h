@@ -0,0 +1,76 @@
+/**
+ * Header file for the FeatArchive class
+ *
+ * An archive is a single file holding many feature matrices, each stored as a
+ * record with a key (e.g. the line id). Records are appended and can be written
+ * concurrently from several threads. When closed, an index is written at the
+ * end of the file, so that a reader can memory map the archive and get any
+ * matrix by key without loading the rest. If the index is missing (e.g. the
+ * writer was killed) it is rebuilt by scanning the records. Records are checked
+ * to be within the file when loaded. Appending a key again replaces it.
+ *
+ * Matrices can be stored in a compact encoding (see quant.h), which read
+ * decodes back to single precision floats.
+ *
+ * File layout, all integers in host byte order:
+ *   record: "TFAR" u32:keylen i32:rows i32:cols i32:type u32:encoding u64:datalen
+ *           key (zero padded to 16 bytes) data (zero padded to 16 bytes)
+ *   skip:   "TFAS" and zeros up to u64:datalen, then datalen bytes of a failed write
+ *   data:   the matrix, preceded for encoding>0 by f32:scale f32:offset u64:0
+ *   index:  for each record u64:offset u32:keylen key
+ *   footer: u64:index_offset u64:num_records "TFAINDEX"
+ *
+ * @version $Version: 2026.10.17$
+ * @copyright Copyright (c) 2016-present, Mauricio Villegas <mauricio_ville@yahoo.com>
+ * @license MIT License
+ */
+
+#ifndef __FEATARCHIVE_H__
+#define __FEATARCHIVE_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+class FeatArchive {
+  public:
+    FeatArchive();
+    ~FeatArchive();
+    static char* version();
+    void open( const char* fname, bool append = true );
+    void openRead( const char* fname );
+    void close();
+    bool isOpen();
+    void setEncoding( int encoding );
+    const std::string& getFilename();
+    bool contains( const std::string& key );
+    void write( const std::string& key, const cv::Mat& feats );
+    bool read( const std::string& key, cv::Mat& feats );
+    std::vector<std::string> keys();
+  private:
+    struct Entry {
+      uint64_t offset;
+      int32_t rows;
+      int32_t cols;
+      int32_t type;
+      uint64_t dataoffset;
+      uint32_t encoding;
+    };
+    std::string fname;
+    int fd = -1;
+    bool readonly = false;
+    int encoding = 0;
+    char *map = NULL;
+    size_t mapsize = 0;
+    uint64_t end = 0;
+    pthread_mutex_t mutex;
+    std::map<std::string,Entry> index;
+    uint64_t scan( const char* data, uint64_t size );
+    bool loadIndex( const char* data, uint64_t size, uint64_t* index_offset );
+};
+
+#endif
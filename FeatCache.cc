@@ -0,0 +1,162 @@
+/**
+ * Class for a persistent cache of extracted features
+ *
+ * @version $Version: 2026.10.17$
+ * @copyright Copyright (c) 2016-present, Mauricio Villegas <mauricio_ville@yahoo.com>
+ * @license MIT License
+ */
+
+#include "FeatCache.h"
+#include "FeatArchive.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <stdexcept>
+
+using namespace std;
+
+/////////////////////
+/// Class version ///
+/////////////////////
+
+static char class_version[] = "Version: 2026.10.17";
+
+/**
+ * Returns the class version.
+ */
+char* FeatCache::version() {
+  return class_version+9;
+}
+
+////////////
+/// Hash ///
+////////////
+
+/**
+ * Hash constructor, sets the FNV-1a 128-bit offset basis.
+ */
+FeatCache::Hash::Hash() {
+  state = ( (unsigned __int128)0x6c62272e07bb0142ULL << 64 ) | 0x62b821756295c58dULL;
+}
+
+/**
+ * Adds bytes to the hash.
+ */
+void FeatCache::Hash::update( const void* data, size_t size ) {
+  static const unsigned __int128 prime = ( (unsigned __int128)0x0000000001000000ULL << 64 ) | 0x000000000000013bULL;
+  const unsigned char *bytes = (const unsigned char*)data;
+  for( size_t n=0; n<size; n++ ) {
+    state ^= bytes[n];
+    state *= prime;
+  }
+}
+
+/**
+ * Adds a string to the hash, including its length so that concatenations differ.
+ */
+void FeatCache::Hash::update( const string& str ) {
+  uint64_t size = str.size();
+  update( &size, sizeof(size) );
+  update( str.data(), str.size() );
+}
+
+/**
+ * Adds a number to the hash.
+ */
+void FeatCache::Hash::update( double value ) {
+  update( &value, sizeof(value) );
+}
+
+/**
+ * Returns the hash as a hexadecimal string.
+ */
+string FeatCache::Hash::hex() {
+  char str[33];
+  snprintf( str, sizeof(str), "%016llx%016llx", (unsigned long long)(state>>64), (unsigned long long)state );
+  return string(str);
+}
+
+//////////////////////
+/// Open and usage ///
+//////////////////////
+
+/**
+ * Opens a cache directory, creating it if it does not exist.
+ *
+ * @param dir   Directory of the cache.
+ */
+void FeatCache::open( const char* _dir ) {
+  if( mkdir( _dir, 0755 ) && errno != EEXIST )
+    throw runtime_error( string("FeatCache: unable to create directory: ")+_dir );
+  dir = _dir;
+}
+
+/**
+ * Returns whether the cache is open.
+ */
+bool FeatCache::isOpen() {
+  return ! dir.empty();
+}
+
+/**
+ * Returns the file name of an entry, in a subdirectory given by the first
+ * characters of the key to keep directories small.
+ */
+string FeatCache::entryName( const string& key ) {
+  return dir+'/'+key.substr(0,2)+'/'+key+".tfa";
+}
+
+/**
+ * Gets the matrices of an entry of the cache. Thread safe.
+ *
+ * @param key    Key of the entry.
+ * @param mats   Set to copies of the matrices of the entry.
+ * @return       Whether the entry was found.
+ */
+bool FeatCache::get( const string& key, vector<cv::Mat>& mats ) {
+  string fname = entryName(key);
+  if( access( fname.c_str(), R_OK ) )
+    return false;
+
+  mats.clear();
+  try {
+    FeatArchive entry;
+    entry.openRead( fname.c_str() );
+    for( int n=0; ; n++ ) {
+      cv::Mat mat;
+      if( ! entry.read( to_string(n), mat ) )
+        break;
+      mats.push_back( mat.clone() );
+    }
+  } catch( const std::exception& e ) {
+    mats.clear();
+  }
+  return mats.size() > 0;
+}
+
+/**
+ * Adds an entry to the cache. Thread safe, also between processes.
+ *
+ * @param key    Key of the entry.
+ * @param mats   Matrices of the entry.
+ */
+void FeatCache::put( const string& key, const vector<cv::Mat>& mats ) {
+  string fname = entryName(key);
+  string subdir = fname.substr(0,fname.rfind('/'));
+  if( mkdir( subdir.c_str(), 0755 ) && errno != EEXIST )
+    throw runtime_error( "FeatCache: unable to create directory: "+subdir );
+
+  string tmpname = fname+".tmp"+to_string(getpid())+"_"+to_string((unsigned long)pthread_self());
+  FeatArchive entry;
+  entry.open( tmpname.c_str(), false );
+  for( int n=0; n<(int)mats.size(); n++ )
+    entry.write( to_string(n), mats[n] );
+  entry.close();
+  if( rename( tmpname.c_str(), fname.c_str() ) ) {
+    unlink( tmpname.c_str() );
+    throw runtime_error( "FeatCache: unable to add entry: "+fname );
+  }
+}
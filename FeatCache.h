@@ -0,0 +1,51 @@
+/**
+ * Header file for the FeatCache class
+ *
+ * A persistent cache of extraction results in a directory, keyed by a hash of
+ * everything the result depends on (e.g. line image pixels, polygon, x-height
+ * and extractor configuration), so that unchanged lines are not recomputed in
+ * later runs. Each entry is a small FeatArchive holding a list of matrices,
+ * written to a temporary file and renamed, so that concurrent runs sharing a
+ * cache never see partial entries.
+ *
+ * @version $Version: 2026.10.17$
+ * @copyright Copyright (c) 2016-present, Mauricio Villegas <mauricio_ville@yahoo.com>
+ * @license MIT License
+ */
+
+#ifndef __FEATCACHE_H__
+#define __FEATCACHE_H__
+
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+class FeatCache {
+  public:
+
+    /**
+     * Incremental 128-bit FNV-1a hash for building cache keys.
+     */
+    class Hash {
+      public:
+        Hash();
+        void update( const void* data, size_t size );
+        void update( const std::string& str );
+        void update( double value );
+        std::string hex();
+      private:
+        unsigned __int128 state;
+    };
+
+    static char* version();
+    void open( const char* dir );
+    bool isOpen();
+    bool get( const std::string& key, std::vector<cv::Mat>& mats );
+    void put( const std::string& key, const std::vector<cv::Mat>& mats );
+  private:
+    std::string dir;
+    std::string entryName( const std::string& key );
+};
+
+#endif
@@ -0,0 +1,180 @@
+/**
+ * Class for tracing the timing of processing stages
+ *
+ * @version $Version: 2026.10.17$
+ * @copyright Copyright (c) 2016-present, Mauricio Villegas <mauricio_ville@yahoo.com>
+ * @license MIT License
+ */
+
+#include "Tracer.h"
+
+#include <unistd.h>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+/**
+ * Trace id of the calling thread, assigned on first use.
+ */
+static __thread int tracer_tid = -1;
+
+/**
+ * Writes a string to a file as a JSON string literal.
+ */
+static void json_string( FILE* file, const char* str ) {
+  fputc( '"', file );
+  for( ; *str; str++ ) {
+    unsigned char c = *str;
+    if( c == '"' || c == '\\' )
+      fprintf( file, "\\%c", c );
+    else if( c < 0x20 )
+      fprintf( file, "\\u%04x", c );
+    else
+      fputc( c, file );
+  }
+  fputc( '"', file );
+}
+
+////////////////////
+/// Constructors ///
+////////////////////
+
+/**
+ * Tracer constructor, times are relative to its creation.
+ */
+Tracer::Tracer() {
+  pthread_mutex_init( &mutex, NULL );
+  origin = chrono::steady_clock::now();
+}
+
+/**
+ * Tracer destructor, closes the trace file if still open.
+ */
+Tracer::~Tracer() {
+  close();
+  pthread_mutex_destroy( &mutex );
+}
+
+//////////////////////
+/// Open and close ///
+//////////////////////
+
+/**
+ * Opens a file to which the spans are written in Chrome trace format.
+ *
+ * @param fname   File name of the trace.
+ */
+void Tracer::open( const char* fname ) {
+  close();
+  trace = fopen( fname, "w" );
+  if( trace == NULL )
+    throw runtime_error( string("Tracer: unable to open: ")+fname );
+  fprintf( trace, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" );
+  first = true;
+}
+
+/**
+ * Finishes and closes the trace file.
+ */
+void Tracer::close() {
+  if( trace == NULL )
+    return;
+  fprintf( trace, "\n]}\n" );
+  fclose( trace );
+  trace = NULL;
+}
+
+///////////////
+/// Tracing ///
+///////////////
+
+/**
+ * Returns the current time in microseconds.
+ */
+int64_t Tracer::now() {
+  return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now()-origin).count();
+}
+
+/**
+ * Returns the trace id of the calling thread. Must be called while locked.
+ */
+int Tracer::threadId() {
+  if( tracer_tid < 0 )
+    tracer_tid = numthreads++;
+  return tracer_tid;
+}
+
+/**
+ * Sets the name shown in the trace for the calling thread.
+ */
+void Tracer::threadName( const char* name ) {
+  pthread_mutex_lock( &mutex );
+  int tid = threadId();
+  if( trace != NULL ) {
+    fprintf( trace, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", first ? "" : ",", (int)getpid(), tid );
+    json_string( trace, name );
+    fprintf( trace, "}}" );
+    first = false;
+  }
+  pthread_mutex_unlock( &mutex );
+}
+
+/**
+ * Records a span of a stage that finishes now. Thread safe.
+ *
+ * @param stage   Name of the stage.
+ * @param start   Start time as given by now().
+ * @param page    Id of the page being processed, or NULL.
+ * @param line    Id of the line being processed, or NULL.
+ */
+void Tracer::span( const char* stage, int64_t start, const char* page, const char* line ) {
+  int64_t dur = now()-start;
+
+  pthread_mutex_lock( &mutex );
+  int tid = threadId();
+  durations[stage].push_back( 0.001*dur );
+  if( trace != NULL ) {
+    fprintf( trace, "%s\n{\"name\":", first ? "" : "," );
+    json_string( trace, stage );
+    fprintf( trace, ",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%lld,\"dur\":%lld", (int)getpid(), tid, (long long)start, (long long)dur );
+    if( page != NULL || line != NULL ) {
+      fprintf( trace, ",\"args\":{" );
+      if( page != NULL ) {
+        fprintf( trace, "\"page\":" );
+        json_string( trace, page );
+      }
+      if( line != NULL ) {
+        fprintf( trace, "%s\"line\":", page != NULL ? "," : "" );
+        json_string( trace, line );
+      }
+      fprintf( trace, "}" );
+    }
+    fprintf( trace, "}" );
+    first = false;
+  }
+  pthread_mutex_unlock( &mutex );
+}
+
+/**
+ * Prints a summary of the durations of each stage.
+ *
+ * @param file   Where to print the summary.
+ */
+void Tracer::summary( FILE* file ) {
+  pthread_mutex_lock( &mutex );
+  fprintf( file, "%-16s %8s %10s %10s %10s %10s %12s\n", "stage", "count", "p50_ms", "p95_ms", "p99_ms", "max_ms", "total_ms" );
+  for( map<string,vector<float> >::iterator it=durations.begin(); it!=durations.end(); it++ ) {
+    vector<float>& dur = it->second;
+    sort( dur.begin(), dur.end() );
+    int num = dur.size();
+    double total = 0.0;
+    for( int n=0; n<num; n++ )
+      total += dur[n];
+    #define PERCENTILE(p) dur[ min( num-1, (int)( (p)*num/100.0 ) ) ]
+    fprintf( file, "%-16s %8d %10.2f %10.2f %10.2f %10.2f %12.1f\n", it->first.c_str(), num,
+      PERCENTILE(50), PERCENTILE(95), PERCENTILE(99), dur[num-1], total );
+    #undef PERCENTILE
+  }
+  pthread_mutex_unlock( &mutex );
+}
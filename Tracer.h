@@ -0,0 +1,48 @@
+/**
+ * Header file for the Tracer class
+ *
+ * Records timing spans of the processing stages (e.g. XML reading, cropping,
+ * preprocessing, extraction, writing and waits) per thread, with the ids of the
+ * page and line being processed. Spans are streamed as they finish to a Chrome
+ * trace JSON file, which can be opened in chrome://tracing or Perfetto, and the
+ * durations are kept per stage to print a summary with count, percentiles and
+ * maximum. When tracing is disabled the Tracer is simply not created, so the
+ * only overhead is a pointer check.
+ *
+ * @version $Version: 2026.10.17$
+ * @copyright Copyright (c) 2016-present, Mauricio Villegas <mauricio_ville@yahoo.com>
+ * @license MIT License
+ */
+
+#ifndef __TRACER_H__
+#define __TRACER_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+class Tracer {
+  public:
+    Tracer();
+    ~Tracer();
+    void open( const char* fname );
+    void close();
+    int64_t now();
+    void threadName( const char* name );
+    void span( const char* stage, int64_t start, const char* page = NULL, const char* line = NULL );
+    void summary( FILE* file );
+  private:
+    FILE *trace = NULL;
+    bool first = true;
+    int numthreads = 0;
+    std::chrono::steady_clock::time_point origin;
+    pthread_mutex_t mutex;
+    std::map<std::string,std::vector<float> > durations;
+    int threadId();
+};
+
+#endif
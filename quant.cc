@@ -0,0 +1,117 @@
+/**
+ * Compact encodings of feature matrices
+ *
+ * @version $Version: 2026.10.17$
+ * @copyright Copyright (c) 2016-present, Mauricio Villegas <mauricio_ville@yahoo.com>
+ * @license MIT License
+ */
+
+#include "quant.h"
+
+#include <math.h>
+#include <string.h>
+#include <stdexcept>
+
+/// cv::convertFp16 is only available since OpenCV 3.2 (2.4 has CV_VERSION_EPOCH 2, MAJOR 4) ///
+#if ! defined(CV_VERSION_EPOCH) && ( CV_VERSION_MAJOR > 3 || ( CV_VERSION_MAJOR == 3 && CV_VERSION_MINOR >= 2 ) )
+#define HAVE_CONVERTFP16 1
+#else
+#define HAVE_CONVERTFP16 0
+#endif
+
+static const char* encoding_names[] = { "none", "f16", "u16", "u8" };
+
+/**
+ * Returns the encoding for a name, -1 if unknown or not supported by the OpenCV version.
+ */
+int featEncoding( const char* name ) {
+  for( int enc=FEAT_RAW; enc<=FEAT_U8; enc++ )
+    if( ! strcmp( name, encoding_names[enc] ) )
+      return enc == FEAT_F16 && ! HAVE_CONVERTFP16 ? -1 : enc ;
+  return -1;
+}
+
+/**
+ * Returns the name of an encoding.
+ */
+const char* featEncodingName( int enc ) {
+  return enc >= FEAT_RAW && enc <= FEAT_U8 ? encoding_names[enc] : "unknown" ;
+}
+
+/**
+ * Encodes a single channel features matrix. The range is taken as in Kaldi
+ * compressed matrices, so that quantized matrices can also be written as such.
+ *
+ * @param feats   Features matrix.
+ * @param data    Set to the encoded matrix.
+ * @param enc     Encoding.
+ * @param scale   Set to the quantization step, 1 if not quantized.
+ * @param offset  Set to the value of q=0, 0 if not quantized.
+ */
+void featEncode( const cv::Mat& feats, cv::Mat& data, int enc, float* scale, float* offset ) {
+  *scale = 1.0;
+  *offset = 0.0;
+
+  switch( enc ) {
+    case FEAT_RAW:
+      data = feats;
+      break;
+    case FEAT_F16:
+#if HAVE_CONVERTFP16
+      if( feats.depth() == CV_32F )
+        cv::convertFp16( feats, data );
+      else {
+        cv::Mat tmp;
+        feats.convertTo( tmp, CV_32F );
+        cv::convertFp16( tmp, data );
+      }
+      break;
+#else
+      throw std::runtime_error( "featEncode: f16 requires OpenCV 3.2 or newer" );
+#endif
+    case FEAT_U16:
+    case FEAT_U8: {
+      double min = 0.0, max = 0.0;
+      if( ! feats.empty() )
+        cv::minMaxLoc( feats, &min, &max );
+      if( max == min )
+        max = min + ( 1.0 + fabs(min) );
+      double levels = enc == FEAT_U16 ? 65535.0 : 255.0 ;
+      *offset = min;
+      *scale = ( max - min ) / levels;
+      feats.convertTo( data, enc == FEAT_U16 ? CV_16U : CV_8U, 1.0 / *scale, -min / *scale );
+      } break;
+    default:
+      throw std::runtime_error( "featEncode: unknown encoding" );
+  }
+}
+
+/**
+ * Decodes a matrix into single precision features.
+ *
+ * @param data    Encoded matrix.
+ * @param feats   Set to the decoded features.
+ * @param enc     Encoding.
+ * @param scale   Quantization step.
+ * @param offset  Value of q=0.
+ */
+void featDecode( const cv::Mat& data, cv::Mat& feats, int enc, float scale, float offset ) {
+  switch( enc ) {
+    case FEAT_RAW:
+      feats = data;
+      break;
+    case FEAT_F16:
+#if HAVE_CONVERTFP16
+      cv::convertFp16( data, feats );
+      break;
+#else
+      throw std::runtime_error( "featDecode: f16 requires OpenCV 3.2 or newer" );
+#endif
+    case FEAT_U16:
+    case FEAT_U8:
+      data.convertTo( feats, CV_32F, scale, offset );
+      break;
+    default:
+      throw std::runtime_error( "featDecode: unknown encoding" );
+  }
+}
@@ -0,0 +1,30 @@
+/**
+ * Compact encodings of feature matrices
+ *
+ * Float16, and affine quantization to uint16 or uint8 with a per-matrix scale
+ * and offset, i.e. value = offset + scale*q. Conversions use the vectorized
+ * OpenCV routines (convertTo, convertFp16, minMaxLoc).
+ *
+ * @version $Version: 2026.10.17$
+ * @copyright Copyright (c) 2016-present, Mauricio Villegas <mauricio_ville@yahoo.com>
+ * @license MIT License
+ */
+
+#ifndef __QUANT_H__
+#define __QUANT_H__
+
+#include <opencv2/opencv.hpp>
+
+enum FeatEncoding {
+  FEAT_RAW = 0,   // Matrix as is
+  FEAT_F16 = 1,   // Float16, stored as CV_16S
+  FEAT_U16 = 2,   // Affine quantized to CV_16U
+  FEAT_U8  = 3    // Affine quantized to CV_8U
+};
+
+int featEncoding( const char* name );
+const char* featEncodingName( int enc );
+void featEncode( const cv::Mat& feats, cv::Mat& data, int enc, float* scale, float* offset );
+void featDecode( const cv::Mat& data, cv::Mat& feats, int enc, float scale, float offset );
+
+#endif
@@ -0,0 +1,96 @@
+/**
+ * Test of feature archives: reads every record of an archive and compares it
+ * with the HTK features file of the same key, exactly for unencoded records
+ * and within the precision of the encoding otherwise.
+ *
+ * Usage: archive_check ARCHIVE DIR (none|f16|u16|u8)
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "../FeatArchive.h"
+#include "../quant.h"
+
+using namespace std;
+
+static int fail( const string& msg ) {
+  fprintf( stderr, "archive_check: %s\n", msg.c_str() );
+  return 1;
+}
+
+static uint32_t be32( const unsigned char* p ) {
+  return ( (uint32_t)p[0] << 24 ) | ( (uint32_t)p[1] << 16 ) | ( (uint32_t)p[2] << 8 ) | p[3];
+}
+
+/**
+ * Reads an HTK file of float features, frames of dim values.
+ */
+static bool read_htk( const string& fname, int* frames, int* dim, vector<float>& values ) {
+  FILE* f = fopen( fname.c_str(), "rb" );
+  if( f == NULL )
+    return false;
+  unsigned char head[12];
+  bool ok = fread( head, 1, 12, f ) == 12;
+  if( ok ) {
+    *frames = be32( head );
+    *dim = ( ( head[8] << 8 ) | head[9] ) / 4;
+    vector<unsigned char> data( (size_t)*frames * *dim * 4 );
+    ok = fread( data.data(), 1, data.size(), f ) == data.size();
+    values.resize( (size_t)*frames * *dim );
+    for( size_t k=0; ok && k<values.size(); k++ ) {
+      uint32_t bits = be32( &data[4*k] );
+      memcpy( &values[k], &bits, 4 );
+    }
+  }
+  fclose( f );
+  return ok;
+}
+
+int main( int argc, char** argv ) {
+  if( argc != 4 )
+    return fail( "usage: archive_check ARCHIVE DIR (none|f16|u16|u8)" );
+  int enc = featEncoding( argv[3] );
+  if( enc < 0 )
+    return fail( string("unknown encoding: ")+argv[3] );
+
+  FeatArchive archive;
+  try {
+    archive.openRead( argv[1] );
+    vector<string> keys = archive.keys();
+    if( keys.empty() )
+      return fail( "no records" );
+
+    for( size_t n=0; n<keys.size(); n++ ) {
+      cv::Mat feats;
+      archive.read( keys[n], feats );
+      int frames, dim;
+      vector<float> values;
+      if( ! read_htk( string(argv[2])+'/'+keys[n]+".fea", &frames, &dim, values ) )
+        return fail( "unable to read features file of "+keys[n] );
+
+      /// One column per frame ///
+      if( feats.type() != CV_32FC1 || feats.cols != frames || feats.rows != dim )
+        return fail( "unexpected size or type of "+keys[n] );
+
+      double min = 0.0, max = 0.0;
+      cv::minMaxLoc( feats, &min, &max );
+      double step = enc == FEAT_U16 ? ( max - min ) / 65535.0 : enc == FEAT_U8 ? ( max - min ) / 255.0 : 0.0 ;
+      for( int t=0; t<frames; t++ )
+        for( int d=0; d<dim; d++ ) {
+          double value = values[(size_t)t*dim+d];
+          double tol = enc == FEAT_F16 ? 1e-3*fabs(value) + 1e-4 : step + 1e-5*( 1.0 + fabs(value) ) ;
+          if( enc == FEAT_RAW ? feats.at<float>(d,t) != value : fabs( feats.at<float>(d,t) - value ) > tol )
+            return fail( "values differ for "+keys[n] );
+        }
+    }
+    printf( "%d records match\n", (int)keys.size() );
+  } catch( const std::exception& e ) {
+    return fail( e.what() );
+  }
+  return 0;
+}
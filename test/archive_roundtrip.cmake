@@ -0,0 +1,52 @@
+execute_process( COMMAND rm -rf test_archive )
+execute_process( COMMAND mkdir -p test_archive/files )
+
+# Configuration for float features in HTK format
+file( READ ${SOURCEDIR}/rawimg.cfg CFG )
+string( REGEX REPLACE "format *= *\"img\"" "format = \"htk\"" CFG "${CFG}" )
+file( WRITE test_archive/htk.cfg "${CFG}" )
+
+# Features written one file per line, as reference
+execute_process( COMMAND ${TEST_PROG} --cfg test_archive/htk.cfg --overwrite --outdir test_archive/files --regproc=false ${SOURCEDIR}/test/test-lines.xml
+                 RESULT_VARIABLE HAD_ERROR )
+if( HAD_ERROR )
+    message( FATAL_ERROR "Test failed - extraction to files" )
+endif()
+file( GLOB FILES test_archive/files/*.fea )
+list( LENGTH FILES NUM_FILES )
+
+foreach( ENC none u16 u8 )
+  # Same features written to a single archive, then read back and compared
+  execute_process( COMMAND ${TEST_PROG} --cfg test_archive/htk.cfg --overwrite --archive=test_archive/feats_${ENC}.tfa --quantize ${ENC} --regproc=false ${SOURCEDIR}/test/test-lines.xml
+                   RESULT_VARIABLE HAD_ERROR )
+  if( HAD_ERROR )
+      message( FATAL_ERROR "Test failed - extraction to archive ${ENC}" )
+  endif()
+  execute_process( COMMAND ${ARCHIVE_CHECK} test_archive/feats_${ENC}.tfa test_archive/files ${ENC}
+                   RESULT_VARIABLE DIFFERENT )
+  if( DIFFERENT )
+      message( FATAL_ERROR "Test failed - archive ${ENC} differs from the features files" )
+  endif()
+endforeach()
+
+# Rerunning without --overwrite appends to the archive, replacing the records
+execute_process( COMMAND ${TEST_PROG} --cfg test_archive/htk.cfg --archive=test_archive/feats_none.tfa --regproc=false ${SOURCEDIR}/test/test-lines.xml
+                 RESULT_VARIABLE HAD_ERROR )
+if( HAD_ERROR )
+    message( FATAL_ERROR "Test failed - rerun appending to archive" )
+endif()
+execute_process( COMMAND ${TEST_PROG} --list-archive test_archive/feats_none.tfa
+                 OUTPUT_VARIABLE LISTING
+                 RESULT_VARIABLE HAD_ERROR )
+string( REGEX MATCHALL "[^\n]+" RECORDS "${LISTING}" )
+list( LENGTH RECORDS NUM_RECORDS )
+if( HAD_ERROR OR NOT NUM_RECORDS EQUAL NUM_FILES )
+    message( FATAL_ERROR "Test failed - appended archive has ${NUM_RECORDS} records, expected ${NUM_FILES}" )
+endif()
+execute_process( COMMAND ${ARCHIVE_CHECK} test_archive/feats_none.tfa test_archive/files none
+                 RESULT_VARIABLE DIFFERENT )
+if( DIFFERENT )
+    message( FATAL_ERROR "Test failed - appended archive differs from the features files" )
+endif()
+
+execute_process( COMMAND rm -r test_archive )
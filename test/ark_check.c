@@ -0,0 +1,113 @@
+/**
+ * Test of Kaldi ark output: decodes the records of an ark, plain float (BFM)
+ * or compressed (CM2, CM3), and compares them with the float records of a
+ * reference ark, allowing for compressed records one quantization step.
+ *
+ * Usage: ark_check REFERENCE.ark TEST.ark
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+
+typedef struct {
+  char key[256];
+  int rows;
+  int cols;
+  float step;     /* Quantization step, 0 for float records */
+  float *data;
+} record;
+
+static int fail( const char* msg, const char* key ) {
+  fprintf( stderr, "ark_check: %s%s%s\n", msg, key ? ": " : "", key ? key : "" );
+  return 1;
+}
+
+/**
+ * Reads the next record of an ark, returns 0 at the end, -1 on error.
+ */
+static int read_record( FILE* ark, record* rec ) {
+  int c, n = 0;
+  while( ( c = fgetc( ark ) ) != EOF && c != ' ' && n < 255 )
+    rec->key[n++] = c;
+  rec->key[n] = '\0';
+  if( c == EOF && n == 0 )
+    return 0;
+  char format[4] = "";
+  if( c != ' ' || fgetc( ark ) != '\0' || fgetc( ark ) != 'B' || fread( format, 1, 3, ark ) != 3 )
+    return -1;
+
+  /// Plain float matrix ///
+  if( ! strcmp( format, "FM " ) ) {
+    int32_t rows, cols;
+    if( fgetc( ark ) != 4 || fread( &rows, 4, 1, ark ) != 1 || fgetc( ark ) != 4 || fread( &cols, 4, 1, ark ) != 1 )
+      return -1;
+    rec->rows = rows;
+    rec->cols = cols;
+    rec->step = 0.0f;
+    rec->data = (float*)malloc( (size_t)rows*cols*sizeof(float)+1 );
+    return fread( rec->data, sizeof(float), (size_t)rows*cols, ark ) == (size_t)rows*cols ? 1 : -1;
+  }
+
+  /// Compressed matrix with global header, 16 or 8 bits ///
+  if( ( ! strcmp( format, "CM2" ) || ! strcmp( format, "CM3" ) ) && fgetc( ark ) == ' ' ) {
+    int bytes = format[2] == '2' ? 2 : 1;
+    float levels = bytes == 2 ? 65535.0f : 255.0f;
+    float min, range;
+    int32_t rows, cols;
+    if( fread( &min, 4, 1, ark ) != 1 || fread( &range, 4, 1, ark ) != 1 || fread( &rows, 4, 1, ark ) != 1 || fread( &cols, 4, 1, ark ) != 1 )
+      return -1;
+    rec->rows = rows;
+    rec->cols = cols;
+    rec->step = range / levels;
+    rec->data = (float*)malloc( (size_t)rows*cols*sizeof(float)+1 );
+    for( size_t k=0; k<(size_t)rows*cols; k++ ) {
+      uint16_t q = 0;
+      if( fread( &q, bytes, 1, ark ) != 1 )
+        return -1;
+      rec->data[k] = min + range * q / levels;
+    }
+    return 1;
+  }
+
+  return -1;
+}
+
+int main( int argc, char** argv ) {
+  if( argc != 3 )
+    return fail( "usage: ark_check REFERENCE.ark TEST.ark", NULL );
+  FILE* ref = fopen( argv[1], "rb" );
+  FILE* test = fopen( argv[2], "rb" );
+  if( ref == NULL || test == NULL )
+    return fail( "unable to open arks", NULL );
+
+  int num = 0;
+  while( 1 ) {
+    record a, b;
+    int ra = read_record( ref, &a );
+    int rb = read_record( test, &b );
+    if( ra < 0 || rb < 0 )
+      return fail( "invalid record", ra < 0 ? a.key : b.key );
+    if( ra != rb )
+      return fail( "different number of records", NULL );
+    if( ra == 0 )
+      break;
+    if( a.step != 0.0f )
+      return fail( "reference record is not float", a.key );
+    if( strcmp( a.key, b.key ) || a.rows != b.rows || a.cols != b.cols )
+      return fail( "different key or size", b.key );
+    for( size_t k=0; k<(size_t)a.rows*a.cols; k++ )
+      if( fabsf( a.data[k] - b.data[k] ) > b.step + 1e-5f*( 1.0f + fabsf(a.data[k]) ) )
+        return fail( "values differ", b.key );
+    free( a.data );
+    free( b.data );
+    num++;
+  }
+
+  if( num == 0 )
+    return fail( "no records", NULL );
+  printf( "%d records match\n", num );
+  return 0;
+}
@@ -0,0 +1,22 @@
+execute_process( COMMAND rm -rf test_ark )
+execute_process( COMMAND mkdir -p test_ark )
+
+# Float (BFM) reference and compressed CM2 (u16) and CM3 (u8) arks of the test page
+foreach( ENC none u16 u8 )
+  execute_process( COMMAND ${TEST_PROG} --cfg ${SOURCEDIR}/rawimg.cfg --overwrite --ark test_ark/${ENC}.ark --arkorder --quantize ${ENC} --regproc=false ${SOURCEDIR}/test/test-image.xml
+                   RESULT_VARIABLE HAD_ERROR )
+  if( HAD_ERROR )
+      message( FATAL_ERROR "Test failed - extraction to ark ${ENC}" )
+  endif()
+endforeach()
+
+# Decoded records must match the float ones up to a quantization step
+foreach( ENC none u16 u8 )
+  execute_process( COMMAND ${ARK_CHECK} test_ark/none.ark test_ark/${ENC}.ark
+                   RESULT_VARIABLE DIFFERENT )
+  if( DIFFERENT )
+      message( FATAL_ERROR "Test failed - ark ${ENC} records differ from the expected" )
+  endif()
+endforeach()
+
+execute_process( COMMAND rm -r test_ark )
@@ -0,0 +1,149 @@
+/**
+ * Test of the batch extraction library: extracts line images together with
+ * tf_extract_gray, plus a narrower crop of the first to check the padding of
+ * the batch, and compares the features of each line with the HTK features
+ * file that the CLI gives for it.
+ *
+ * Usage: batch_extract CFG LINE.pgm LINE.fea [LINE.pgm LINE.fea ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "../textFeatsBatch.h"
+
+static int fail( const char* msg, const char* fname ) {
+  fprintf( stderr, "batch_extract: %s%s%s\n", msg, fname ? ": " : "", fname ? fname : "" );
+  return 1;
+}
+
+static uint32_t be32( const unsigned char* p ) {
+  return ( (uint32_t)p[0] << 24 ) | ( (uint32_t)p[1] << 16 ) | ( (uint32_t)p[2] << 8 ) | p[3];
+}
+
+/**
+ * Reads an 8-bit binary pgm, returns NULL on error.
+ */
+static unsigned char* read_pgm( const char* fname, int* width, int* height ) {
+  FILE* f = fopen( fname, "rb" );
+  int maxval;
+  if( f == NULL )
+    return NULL;
+  if( fscanf( f, "P5 %d %d %d", width, height, &maxval ) != 3 || maxval > 255 || fgetc( f ) == EOF ) {
+    fclose( f );
+    return NULL;
+  }
+  unsigned char* pixels = (unsigned char*)malloc( (size_t)*width**height );
+  if( fread( pixels, 1, (size_t)*width**height, f ) != (size_t)*width**height ) {
+    free( pixels );
+    pixels = NULL;
+  }
+  fclose( f );
+  return pixels;
+}
+
+/**
+ * Reads an HTK file of float features, frames of dim values, returns NULL on error.
+ */
+static float* read_htk( const char* fname, int* frames, int* dim ) {
+  FILE* f = fopen( fname, "rb" );
+  unsigned char head[12];
+  if( f == NULL )
+    return NULL;
+  if( fread( head, 1, 12, f ) != 12 ) {
+    fclose( f );
+    return NULL;
+  }
+  *frames = be32( head );
+  *dim = ( ( head[8] << 8 ) | head[9] ) / 4;
+  size_t num = (size_t)*frames * *dim;
+  unsigned char* data = (unsigned char*)malloc( 4*num+1 );
+  float* values = (float*)malloc( sizeof(float)*num+1 );
+  if( fread( data, 1, 4*num, f ) != 4*num ) {
+    free( values );
+    values = NULL;
+  }
+  for( size_t k=0; values != NULL && k<num; k++ ) {
+    uint32_t bits = be32( &data[4*k] );
+    memcpy( &values[k], &bits, 4 );
+  }
+  free( data );
+  fclose( f );
+  return values;
+}
+
+int main( int argc, char** argv ) {
+  if( argc < 4 || argc % 2 )
+    return fail( "usage: batch_extract CFG LINE.pgm LINE.fea [LINE.pgm LINE.fea ...]", NULL );
+
+  /// Read the line images, the last sample is the left half of the first ///
+  int lines = ( argc - 2 ) / 2;
+  int num = lines + 1;
+  unsigned char** pixels = (unsigned char**)malloc( sizeof(unsigned char*)*num );
+  int* widths = (int*)malloc( sizeof(int)*num );
+  int* heights = (int*)malloc( sizeof(int)*num );
+  int* strides = (int*)malloc( sizeof(int)*num );
+  for( int n=0; n<lines; n++ ) {
+    pixels[n] = read_pgm( argv[2+2*n], &widths[n], &heights[n] );
+    if( pixels[n] == NULL )
+      return fail( "unable to read pgm", argv[2+2*n] );
+    strides[n] = widths[n];
+  }
+  pixels[lines] = pixels[0];
+  widths[lines] = widths[0] / 2;
+  heights[lines] = heights[0];
+  strides[lines] = strides[0];
+
+  /// Extract all as a padded batch ///
+  tf_extractor* tf = tf_create( argv[1], 2 );
+  tf_batch batch;
+  if( tf == NULL || tf_extract_gray( tf, num, (const unsigned char**)pixels, widths, heights, strides, 1, &batch ) )
+    return fail( tf_last_error(), NULL );
+
+  /// Check the batch layout ///
+  if( batch.num != num || ! batch.padded || batch.dim <= 0 )
+    return fail( "unexpected batch", NULL );
+  for( int n=0; n<num; n++ ) {
+    if( ! batch.ok[n] || batch.widths[n] > batch.maxwidth )
+      return fail( "unexpected sample widths", NULL );
+    if( batch.offsets[n] != (long)n*batch.maxwidth*batch.dim )
+      return fail( "unexpected sample offsets", NULL );
+    const float* pad = batch.data + batch.offsets[n];
+    for( long k=(long)batch.widths[n]*batch.dim; k<(long)batch.maxwidth*batch.dim; k++ )
+      if( pad[k] != 0.0f )
+        return fail( "padding is not zero", NULL );
+  }
+  if( batch.widths[lines] >= batch.widths[0] )
+    return fail( "half line is not narrower", NULL );
+
+  /// Compare the unpadded features of each line with the CLI ///
+  for( int n=0; n<lines; n++ ) {
+    const char* fname = argv[3+2*n];
+    int frames, dim;
+    float* values = read_htk( fname, &frames, &dim );
+    if( values == NULL )
+      return fail( "unable to read features file", fname );
+    if( frames != batch.widths[n] || dim != batch.dim )
+      return fail( "width or dim differ from command line", fname );
+    const float* feats = batch.data + batch.offsets[n];
+    for( size_t k=0; k<(size_t)frames*dim; k++ )
+      if( fabsf( feats[k] - values[k] ) > 1e-4f*( 1.0f + fabsf(values[k]) ) )
+        return fail( "values differ from command line", fname );
+    free( values );
+  }
+
+  printf( "%d lines match\n", lines );
+
+  tf_batch_free( &batch );
+  tf_destroy( tf );
+  for( int n=0; n<lines; n++ )
+    free( pixels[n] );
+  free( pixels );
+  free( widths );
+  free( heights );
+  free( strides );
+  return 0;
+}
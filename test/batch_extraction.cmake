@@ -0,0 +1,39 @@
+execute_process( COMMAND rm -rf test_batch )
+execute_process( COMMAND mkdir -p test_batch/line test_batch/cli )
+
+# Line images, the raw features of the lines of the test page
+execute_process( COMMAND ${TEST_PROG} --cfg ${SOURCEDIR}/rawimg.cfg --overwrite --outdir test_batch/line --imgext pgm --regproc=false ${SOURCEDIR}/test/test-lines.xml
+                 RESULT_VARIABLE HAD_ERROR )
+if( HAD_ERROR )
+    message( FATAL_ERROR "Test failed - line image extraction" )
+endif()
+file( GLOB LINES test_batch/line/*.pgm )
+list( LENGTH LINES NUM_LINES )
+if( NUM_LINES LESS 2 )
+    message( FATAL_ERROR "Test failed - expected several line images" )
+endif()
+
+# Features of the line images with the command line tool, in HTK format
+file( READ ${SOURCEDIR}/rawimg.cfg CFG )
+string( REGEX REPLACE "format *= *\"img\"" "format = \"htk\"" CFG "${CFG}" )
+file( WRITE test_batch/htk.cfg "${CFG}" )
+execute_process( COMMAND ${TEST_PROG} --cfg test_batch/htk.cfg --overwrite --outdir test_batch/cli ${LINES}
+                 RESULT_VARIABLE HAD_ERROR )
+if( HAD_ERROR )
+    message( FATAL_ERROR "Test failed - command line extraction" )
+endif()
+
+# Features of the line images with the library, compared with the command line
+set( BATCH_ARGS "" )
+foreach( LINE ${LINES} )
+  get_filename_component( NAME ${LINE} NAME )
+  string( REGEX REPLACE "\\.pgm$" ".fea" NAME "${NAME}" )
+  list( APPEND BATCH_ARGS ${LINE} test_batch/cli/${NAME} )
+endforeach()
+execute_process( COMMAND ${BATCH_PROG} ${SOURCEDIR}/rawimg.cfg ${BATCH_ARGS}
+                 RESULT_VARIABLE HAD_ERROR )
+if( HAD_ERROR )
+    message( FATAL_ERROR "Test failed - batch extraction differs from command line" )
+endif()
+
+execute_process( COMMAND rm -r test_batch )
@@ -0,0 +1,211 @@
+#!/bin/bash
+
+##
+## Reproducible throughput benchmark of textFeats, optionally checked against
+## a stored baseline to detect performance regressions.
+##
+
+if [ "$#" -lt 1 ] || [ "$1" = "-h" ] || [ "$1" = "--help" ]; then
+  echo "
+DESCRIPTION
+  Runs textFeats on synthetic line images of several heights and widths and on
+  copies of the bundled test page, for several configurations and numbers of
+  threads. Prints tab separated results: overall lines per second (stage 'all')
+  and for each traced stage its count, total time and spans per second. For
+  each archive encoding, the raw_htk features of all inputs are written to an
+  archive, giving rows 'archive_ENC 1 file_bytes BYTES' and the fastest
+  decoding of the archive as 'archive_ENC 1 load RECORDS MS RECORDS/S'.
+
+  With -b the results are compared with a baseline, failing if the overall
+  throughput of any configuration dropped by more than the margin. The exit
+  code is 77 (skipped) if the baseline file does not exist.
+
+SYNOPSIS
+  Usage: ${0##*/} [OPTIONS] TEXTFEATS
+
+OPTIONS
+  -o FILE   Write results to FILE instead of stdout.
+  -c LIST   Configurations to run (def.=\"raw_img raw_htk raw_ascii dotm_htk nomoment rand\").
+  -T LIST   Numbers of extraction threads (def.=1 2 4 ... nproc).
+  -n NUM    Copies of each synthetic line image (def.=8).
+  -p NUM    Copies of the bundled test page (def.=4).
+  -r RUNS   Runs per case, the fastest is reported (def.=3).
+  -e LIST   Archive encodings to compare, empty for none (def.=\"none f16 u16 u8\").
+  -b FILE   Baseline results to check against, only its cases are run.
+  -m PCT    Allowed throughput drop in percent with respect to baseline (def.=20).
+";
+  exit 0;
+fi
+
+SRCDIR=$(cd "$(dirname "$0")/.." && pwd);
+CONFIGS="raw_img raw_htk raw_ascii dotm_htk nomoment rand";
+THREADS="";
+NCOPIES="8";
+NPAGES="4";
+RUNS="3";
+OUTFILE="";
+BASELINE="";
+MARGIN="20";
+ENCODINGS="none f16 u16 u8";
+while [ "${1:0:1}" = "-" ]; do
+  case "$1" in
+    "-o" ) OUTFILE="$2"; ;;
+    "-c" ) CONFIGS="$2"; ;;
+    "-T" ) THREADS="$2"; ;;
+    "-n" ) NCOPIES="$2"; ;;
+    "-p" ) NPAGES="$2"; ;;
+    "-r" ) RUNS="$2"; ;;
+    "-b" ) BASELINE="$2"; ;;
+    "-m" ) MARGIN="$2"; ;;
+    "-e" ) ENCODINGS="$2"; ;;
+    * ) echo "${0##*/}: error: unexpected option: $1" 1>&2; exit 1; ;;
+  esac
+  shift 2;
+done
+BIN="$1";
+
+if [ "$BASELINE" != "" ]; then
+  [ ! -f "$BASELINE" ] && echo "${0##*/}: no baseline, skipping: $BASELINE" 1>&2 && exit 77;
+  CONFIGS=$(awk -F'\t' '$3=="all" { print $1 }' "$BASELINE" | sort -u | tr '\n' ' ');
+  ENCODINGS="";
+  THREADS=$(awk -F'\t' '$3=="all" { print $2 }' "$BASELINE" | sort -nu | tr '\n' ' ');
+fi
+if [ "$THREADS" = "" ]; then
+  NPROC=$(nproc);
+  for (( t=1; t<NPROC; t*=2 )); do THREADS="$THREADS $t"; done;
+  THREADS="$THREADS $NPROC";
+fi
+
+TMP=$(mktemp -d);
+trap "rm -rf $TMP" EXIT;
+
+### Synthetic line images, deterministic pseudo-text strokes ###
+mkdir "$TMP/in";
+for h in 32 64 128; do
+  for w in 400 1600; do
+    for n in $(seq 1 "$NCOPIES"); do
+      awk -v W="$w" -v H="$h" -v SEED="$h$w$n" '
+        BEGIN {
+          srand(SEED);
+          for( x=0; x<W; x++ )
+            col[x] = 0;
+          for( x=int(H/2); x<W-H/2; x+=1+int(rand()*H/4) ) {
+            top = int(H*(0.2+0.15*rand()));
+            bot = int(H*(0.65+0.15*rand()));
+            wid = 1+int(rand()*H/8);
+            for( k=0; k<wid && x+k<W; k++ ) {
+              tops[x+k] = top;
+              bots[x+k] = bot;
+              col[x+k] = 1;
+            }
+            x += wid;
+          }
+          printf( "P2\n%d %d\n255\n", W, H );
+          for( y=0; y<H; y++ ) {
+            line = "";
+            for( x=0; x<W; x++ )
+              line = line ( col[x] && y>=tops[x] && y<=bots[x] ? 30+int(rand()*40) : 220+int(rand()*30) ) " ";
+            print line;
+          }
+        }' > "$TMP/in/line_h${h}_w${w}_$n.pgm";
+    done
+  done
+done
+
+### Copies of the bundled test page ###
+for n in $(seq 1 "$NPAGES"); do
+  cp "$SRCDIR/test/test-image.png" "$TMP/in/page_$n.png";
+  sed "s|imageFilename=\"[^\"]*\"|imageFilename=\"page_$n.png\"|" "$SRCDIR/test/test-image.xml" > "$TMP/in/page_$n.xml";
+done
+INPUTS=( "$TMP"/in/line_*.pgm "$TMP"/in/page_*.xml );
+
+### Configurations derived from rawimg.cfg ###
+config () {
+  local CFG="$TMP/$1.cfg";
+  case "$1" in
+    raw_img )   sed 's|^\( *format *=\).*|\1 "img";|' "$SRCDIR/rawimg.cfg"; ;;
+    raw_htk )   sed 's|^\( *format *=\).*|\1 "htk";|' "$SRCDIR/rawimg.cfg"; ;;
+    raw_ascii ) sed 's|^\( *format *=\).*|\1 "ascii";|' "$SRCDIR/rawimg.cfg"; ;;
+    dotm_htk )  sed 's|^\( *type *=\).*|\1 "dotm";|; s|^\( *format *=\).*|\1 "htk";|' "$SRCDIR/rawimg.cfg"; ;;
+    nomoment )  sed 's|^\( *momentnorm *=\).*|\1 false;|; s|^\( *fpgram *=\).*|\1 false;|; s|^\( *fcontour *=\).*|\1 false;|' "$SRCDIR/rawimg.cfg"; ;;
+    rand )      cat "$SRCDIR/rawimg.cfg"; ;;
+    * ) echo "${0##*/}: error: unknown configuration: $1" 1>&2; exit 1; ;;
+  esac > "$CFG";
+  echo "$CFG";
+}
+
+### Run all cases ###
+RESULTS="$TMP/results.tsv";
+printf "#config\tthreads\tstage\tcount\ttotal_ms\tper_second\n" > "$RESULTS";
+for c in $CONFIGS; do
+  CFG=$(config "$c") || exit 1;
+  OPTS=( --cfg "$CFG" --overwrite --regproc=false --savexml );
+  [ "$c" = "rand" ] && OPTS+=( --rand 3 );
+  for t in $THREADS; do
+    BEST="";
+    for r in $(seq 1 "$RUNS"); do
+      OUT="$TMP/out";
+      rm -rf "$OUT";
+      mkdir -p "$OUT"/{0,1,2};
+      "$BIN" "${OPTS[@]}" -T "$t" -V 2 --trace --outdir "$OUT" "${INPUTS[@]}" 2> "$TMP/log" > /dev/null ||
+        { echo "${0##*/}: error: run failed: config=$c threads=$t" 1>&2; cat "$TMP/log" 1>&2; exit 1; };
+      TIME=$(sed -n '/total time:/{ s|.*: ||; s| ms||; p; }' "$TMP/log");
+      if [ "$BEST" = "" ] || awk -v A="$TIME" -v B="$BEST" 'BEGIN { exit !(A<B) }'; then
+        BEST="$TIME";
+        cp "$TMP/log" "$TMP/best.log";
+      fi
+    done
+    LINES=$(sed -n '/extracted features for/{ s|.* for ||; s| samples||; p; }' "$TMP/best.log");
+    awk -v C="$c" -v T="$t" -v N="$LINES" -v MS="$BEST" '
+      BEGIN { OFS="\t"; print C, T, "all", N, MS, sprintf("%.2f",1000*N/MS); }
+      /stage timing summary:/ { summary = 1; next; }
+      summary && NF == 7 && $2 ~ /^[0-9]+$/ && $7 > 0 { print C, T, $1, $2, $7, sprintf("%.2f",1000*$2/$7); }
+      ' "$TMP/best.log" >> "$RESULTS";
+  done
+done
+
+### Size and load throughput of archive encodings ###
+if [ "$ENCODINGS" != "" ]; then
+  CFG=$(config raw_htk) || exit 1;
+  for e in $ENCODINGS; do
+    ARCH="$TMP/feats_$e.tfa";
+    rm -f "$ARCH";
+    "$BIN" --cfg "$CFG" --overwrite --regproc=false -T "$(nproc)" --archive="$ARCH" --quantize "$e" --outdir "$TMP" "${INPUTS[@]}" 2> "$TMP/log" > /dev/null ||
+      { echo "${0##*/}: error: run failed: encoding=$e" 1>&2; cat "$TMP/log" 1>&2; exit 1; };
+    printf "archive_%s\t1\tfile_bytes\t%s\t0\t0\n" "$e" "$(stat -c %s "$ARCH")" >> "$RESULTS";
+    BEST="";
+    for r in $(seq 1 "$RUNS"); do
+      cat "$ARCH" > /dev/null;
+      "$BIN" --list-archive -V 1 "$ARCH" 2> "$TMP/log" > /dev/null ||
+        { echo "${0##*/}: error: reading failed: encoding=$e" 1>&2; cat "$TMP/log" 1>&2; exit 1; };
+      LINE=$(sed -n '/read [0-9]* records/{ s|.*read ||; p; }' "$TMP/log");
+      TIME=$(echo "$LINE" | sed 's|.* in \([0-9.]*\) ms.*|\1|');
+      if [ "$BEST" = "" ] || awk -v A="$TIME" -v B="$BEST" 'BEGIN { exit !(A<B) }'; then
+        BEST="$TIME";
+        RECS=$(echo "$LINE" | sed 's| records.*||');
+      fi
+    done
+    awk -v E="$e" -v N="$RECS" -v MS="$BEST" 'BEGIN { OFS="\t"; print "archive_"E, 1, "load", N, MS, sprintf("%.2f",MS>0?1000*N/MS:0); }' >> "$RESULTS";
+  done
+fi
+
+if [ "$OUTFILE" != "" ]; then
+  cp "$RESULTS" "$OUTFILE";
+else
+  cat "$RESULTS";
+fi
+
+### Check against baseline ###
+if [ "$BASELINE" != "" ]; then
+  awk -F'\t' -v M="$MARGIN" '
+    FNR == NR { if( $3 == "all" ) base[$1"\t"$2] = $6; next; }
+    $3 == "all" && ($1"\t"$2) in base {
+      drop = 100*(1-$6/base[$1"\t"$2]);
+      status = drop > M ? "REGRESSION" : "ok";
+      printf( "%s\tthreads=%s\t%.2f vs %.2f lines/s\t%+.1f%%\t%s\n", $1, $2, $6, base[$1"\t"$2], -drop, status ) > "/dev/stderr";
+      if( drop > M )
+        fail = 1;
+    }
+    END { exit fail; }' "$BASELINE" "$RESULTS" ||
+    { echo "${0##*/}: error: throughput dropped more than $MARGIN% with respect to baseline" 1>&2; exit 1; };
+fi
@@ -0,0 +1,60 @@
+#!/bin/bash
+
+##
+## Compares throughput, peak memory and output of two textFeats builds, one
+## with the default Magick++ images and one configured with -DIMG_OPENCV=ON.
+##
+
+if [ "$#" -lt 2 ] || [ "$1" = "-h" ] || [ "$1" = "--help" ]; then
+  echo "
+DESCRIPTION
+  Runs two textFeats builds on the same pages, reporting the average wall time,
+  peak RSS and whether the extracted features are identical.
+
+SYNOPSIS
+  Usage: ${0##*/} TEXTFEATS_MAGICK TEXTFEATS_OPENCV [OPTIONS] [PAGE.xml ...]
+
+OPTIONS
+  -r RUNS   Number of runs per build (def.=3).
+  -T NUM    Number of extraction threads (def.=1).
+  -C CFG    Configuration file (def.=rawimg.cfg of the source).
+";
+  exit 0;
+fi
+
+SRCDIR=$(cd "$(dirname "$0")/.." && pwd);
+BINS=( "$1" "$2" );
+shift 2;
+RUNS="3";
+THREADS="1";
+CFG="$SRCDIR/rawimg.cfg";
+while [ "${1:0:1}" = "-" ]; do
+  case "$1" in
+    "-r" ) RUNS="$2"; ;;
+    "-T" ) THREADS="$2"; ;;
+    "-C" ) CFG="$2"; ;;
+    * ) echo "${0##*/}: error: unexpected option: $1" 1>&2; exit 1; ;;
+  esac
+  shift 2;
+done
+PAGES=( "$@" );
+[ "${#PAGES[@]}" = 0 ] && PAGES=( "$SRCDIR/test/test-image.xml" );
+
+TMP=$(mktemp -d);
+trap "rm -rf $TMP" EXIT;
+
+printf "%-10s %12s %12s %s\n" backend "time[ms]" "peakRSS[MB]" output-md5;
+for b in 0 1; do
+  NAME=$( [ "$b" = 0 ] && echo magick || echo opencv );
+  OUT="$TMP/$NAME";
+  mkdir "$OUT";
+  TOT="0";
+  for r in $(seq 1 "$RUNS"); do
+    "${BINS[$b]}" --cfg "$CFG" -T "$THREADS" -V 2 --overwrite --regproc=false --outdir "$OUT" "${PAGES[@]}" \
+      2> "$TMP/$NAME.log" > /dev/null || { echo "${0##*/}: error: $NAME run failed" 1>&2; cat "$TMP/$NAME.log" 1>&2; exit 1; };
+    TOT=$(sed -n '/total time:/{ s|.*: ||; s| ms||; p; }' "$TMP/$NAME.log" | awk -v T="$TOT" '{ print T+$1 }');
+  done
+  RSS=$(sed -n '/peak memory/{ s|.*: ||; s| MB||; p; }' "$TMP/$NAME.log");
+  MD5=$(cd "$OUT" && find . -type f | sort | xargs cat | md5sum | cut -d' ' -f1);
+  printf "%-10s %12.0f %12s %s\n" "$NAME" $(echo "$TOT $RUNS" | awk '{ print $1/$2 }') "$RSS" "$MD5";
+done
@@ -0,0 +1,72 @@
+execute_process( COMMAND rm -rf test_join )
+
+# Per line features, to check the assembly of the joined ones
+execute_process( COMMAND mkdir -p test_join/lines )
+execute_process( COMMAND ${TEST_PROG} --cfg ${SOURCEDIR}/rawimg.cfg --overwrite --outdir test_join/lines --imgext pgm --regproc=false ${SOURCEDIR}/test/test-lines.xml
+                 RESULT_VARIABLE HAD_ERROR )
+if( HAD_ERROR )
+    message( FATAL_ERROR "Test failed - extraction of lines" )
+endif()
+
+# Reads a pgm, setting PREFIX_WIDTH, PREFIX_HEIGHT and PREFIX_PIXELS in hex
+function( read_pgm FILE PREFIX )
+  file( READ ${FILE} HEADER LIMIT 32 )
+  string( REGEX MATCH "^P5[ \t\r\n]+([0-9]+)[ \t\r\n]+([0-9]+)[ \t\r\n]+255[ \t\r\n]" HEADER "${HEADER}" )
+  string( LENGTH "${HEADER}" HEADER_LENGTH )
+  file( READ ${FILE} PIXELS OFFSET ${HEADER_LENGTH} HEX )
+  set( ${PREFIX}_WIDTH ${CMAKE_MATCH_1} PARENT_SCOPE )
+  set( ${PREFIX}_HEIGHT ${CMAKE_MATCH_2} PARENT_SCOPE )
+  set( ${PREFIX}_PIXELS ${PIXELS} PARENT_SCOPE )
+endfunction()
+
+foreach( RAND 0 3 )
+  foreach( T 1 4 )
+    set( OUT test_join/rand${RAND}_T${T} )
+    execute_process( COMMAND mkdir -p ${OUT} )
+    execute_process( COMMAND ${TEST_PROG} --cfg ${SOURCEDIR}/rawimg.cfg --overwrite --outdir ${OUT} --imgext pgm --regproc=false --savexml --join --rand ${RAND} --seed 7 -T ${T} ${SOURCEDIR}/test/test-lines.xml
+                     RESULT_VARIABLE HAD_ERROR )
+    if( HAD_ERROR )
+        message( FATAL_ERROR "Test failed - joined extraction with --rand ${RAND} and ${T} threads" )
+    endif()
+  endforeach()
+
+  execute_process( COMMAND diff -r test_join/rand${RAND}_T1 test_join/rand${RAND}_T4
+                   RESULT_VARIABLE DIFFERENT )
+  if( DIFFERENT )
+      message( FATAL_ERROR "Test failed - joined features with --rand ${RAND} differ between 1 and 4 threads" )
+  endif()
+endforeach()
+
+# Without perturbations each region is its lines side by side in document order
+foreach( REGION r1 r2 )
+  file( GLOB JOINED test_join/rand0_T1/*${REGION}.pgm )
+  if( NOT JOINED )
+      message( FATAL_ERROR "Test failed - no joined features for region ${REGION}" )
+  endif()
+  read_pgm( ${JOINED} JOIN )
+  file( GLOB LINE1 test_join/lines/*${REGION}_l1.pgm )
+  file( GLOB LINE2 test_join/lines/*${REGION}_l2.pgm )
+  read_pgm( ${LINE1} L1 )
+  read_pgm( ${LINE2} L2 )
+  math( EXPR WIDTH "${L1_WIDTH} + ${L2_WIDTH}" )
+  if( NOT JOIN_WIDTH EQUAL WIDTH OR NOT JOIN_HEIGHT EQUAL L1_HEIGHT OR NOT JOIN_HEIGHT EQUAL L2_HEIGHT )
+      message( FATAL_ERROR "Test failed - joined size of ${REGION} is ${JOIN_WIDTH}x${JOIN_HEIGHT}, expected ${WIDTH}x${L1_HEIGHT}" )
+  endif()
+  math( EXPR LAST_ROW "${JOIN_HEIGHT} - 1" )
+  foreach( ROW RANGE ${LAST_ROW} )
+    math( EXPR JOIN_START "2 * ${ROW} * ${JOIN_WIDTH}" )
+    math( EXPR L1_START "2 * ${ROW} * ${L1_WIDTH}" )
+    math( EXPR L2_START "2 * ${ROW} * ${L2_WIDTH}" )
+    math( EXPR L1_LEN "2 * ${L1_WIDTH}" )
+    math( EXPR L2_LEN "2 * ${L2_WIDTH}" )
+    math( EXPR JOIN_LEN "2 * ${JOIN_WIDTH}" )
+    string( SUBSTRING "${JOIN_PIXELS}" ${JOIN_START} ${JOIN_LEN} JOIN_ROW )
+    string( SUBSTRING "${L1_PIXELS}" ${L1_START} ${L1_LEN} L1_ROW )
+    string( SUBSTRING "${L2_PIXELS}" ${L2_START} ${L2_LEN} L2_ROW )
+    if( NOT JOIN_ROW STREQUAL "${L1_ROW}${L2_ROW}" )
+        message( FATAL_ERROR "Test failed - joined features of ${REGION} differ from its lines in document order at row ${ROW}" )
+    endif()
+  endforeach()
+endforeach()
+
+execute_process( COMMAND rm -r test_join )
@@ -0,0 +1,30 @@
+execute_process( COMMAND rm -rf test_lazy )
+
+# Lines cropped when the page is read and by the extraction threads
+foreach( CROP eager lazy )
+  execute_process( COMMAND mkdir -p test_lazy/${CROP} )
+  if( CROP STREQUAL lazy )
+    set( CROP_OPT --lazycrop )
+  else()
+    set( CROP_OPT --lazycrop=false )
+  endif()
+  execute_process( COMMAND ${TEST_PROG} --cfg ${SOURCEDIR}/rawimg.cfg --overwrite --outdir test_lazy/${CROP} --imgext pgm --regproc=false --savexml -T 2 ${CROP_OPT} ${SOURCEDIR}/test/test-lines.xml
+                   RESULT_VARIABLE HAD_ERROR )
+  if( HAD_ERROR )
+      message( FATAL_ERROR "Test failed - ${CROP} cropping" )
+  endif()
+endforeach()
+
+file( GLOB LINES test_lazy/lazy/*.pgm )
+list( LENGTH LINES NUM_LINES )
+if( NOT NUM_LINES EQUAL 4 )
+    message( FATAL_ERROR "Test failed - expected 4 line images, got ${NUM_LINES}" )
+endif()
+
+execute_process( COMMAND diff -r test_lazy/eager test_lazy/lazy
+                 RESULT_VARIABLE DIFFERENT )
+if( DIFFERENT )
+    message( FATAL_ERROR "Test failed - output with --lazycrop differs from eager cropping" )
+endif()
+
+execute_process( COMMAND rm -r test_lazy )
@@ -0,0 +1,10 @@
+# The tool under test must be the OpenCV build, not a Magick++ one
+execute_process( COMMAND ${TEST_PROG} --version
+                 ERROR_VARIABLE VERSION
+                 RESULT_VARIABLE HAD_ERROR )
+if( HAD_ERROR OR NOT VERSION MATCHES "image backend: OpenCV" )
+    message( FATAL_ERROR "Test failed - tool is not built with the OpenCV image backend" )
+endif()
+
+# Which reproduces the outputs of the Magick++ build
+include( ${SOURCEDIR}/test/raw_xml_extraction.cmake )
@@ -0,0 +1,31 @@
+execute_process( COMMAND rm -rf test_pdf )
+execute_process( COMMAND mkdir -p test_pdf/direct test_pdf/miss test_pdf/hit )
+
+# Pages loaded directly from the pdf, then rasterized into the cache and read from it
+foreach( RUN direct miss hit )
+  if( RUN STREQUAL direct )
+    set( CACHE_OPT "" )
+  else()
+    set( CACHE_OPT --rastercache test_pdf/cache )
+  endif()
+  execute_process( COMMAND ${TEST_PROG} --cfg ${SOURCEDIR}/rawimg.cfg --overwrite --outdir test_pdf/${RUN} --imgext pgm --regproc=false --savexml --density 72 ${CACHE_OPT} ${SOURCEDIR}/test/test-pdf.xml
+                   RESULT_VARIABLE HAD_ERROR )
+  if( HAD_ERROR )
+      message( FATAL_ERROR "Test failed - pdf extraction ${RUN}" )
+  endif()
+endforeach()
+
+file( GLOB_RECURSE CACHED test_pdf/cache/*.png )
+if( NOT CACHED )
+    message( FATAL_ERROR "Test failed - no pages in the raster cache" )
+endif()
+
+foreach( RUN miss hit )
+  execute_process( COMMAND diff -r test_pdf/direct test_pdf/${RUN}
+                   RESULT_VARIABLE DIFFERENT )
+  if( DIFFERENT )
+      message( FATAL_ERROR "Test failed - output with raster cache ${RUN} differs from loading the pdf directly" )
+  endif()
+endforeach()
+
+execute_process( COMMAND rm -r test_pdf )
@@ -0,0 +1,34 @@
+execute_process( COMMAND rm -rf test_rand_T1 test_rand_T4 )
+execute_process( COMMAND mkdir -p test_rand_T1 test_rand_T4 )
+
+foreach( T 1 4 )
+  execute_process( COMMAND ${TEST_PROG} --cfg ${SOURCEDIR}/rawimg.cfg --overwrite --outdir test_rand_T${T} --imgext pgm --regproc=false --savexml --rand 3 --firstrand --seed 7 -T ${T} ${SOURCEDIR}/test/test-lines.xml
+                   RESULT_VARIABLE HAD_ERROR )
+  if( HAD_ERROR )
+      message( FATAL_ERROR "Test failed - extraction with ${T} threads" )
+  endif()
+endforeach()
+
+# Every replica of every line, perturbed so that they are not all the same
+file( GLOB_RECURSE REPLICAS test_rand_T4/*.pgm )
+list( LENGTH REPLICAS NUM_REPLICAS )
+if( NOT NUM_REPLICAS EQUAL 12 )
+    message( FATAL_ERROR "Test failed - expected 3 replicas of 4 lines, got ${NUM_REPLICAS}" )
+endif()
+execute_process( COMMAND md5sum ${REPLICAS}
+                 COMMAND cut -d " " -f 1
+                 COMMAND sort -u
+                 COMMAND wc -l
+                 OUTPUT_VARIABLE NUM_DISTINCT
+                 OUTPUT_STRIP_TRAILING_WHITESPACE )
+if( NOT NUM_DISTINCT GREATER 4 )
+    message( FATAL_ERROR "Test failed - only ${NUM_DISTINCT} distinct of 12 perturbed replicas" )
+endif()
+
+execute_process( COMMAND diff -r test_rand_T1 test_rand_T4
+                 RESULT_VARIABLE DIFFERENT )
+if( DIFFERENT )
+    message( FATAL_ERROR "Test failed - perturbed features differ between 1 and 4 threads" )
+endif()
+
+execute_process( COMMAND rm -r test_rand_T1 test_rand_T4 )
@@ -0,0 +1,48 @@
+execute_process( COMMAND rm -rf test_shards )
+execute_process( COMMAND mkdir -p test_shards/full test_shards/0 test_shards/1 test_shards/merged )
+
+# Unsharded extraction as reference, then each shard extracts half of the lines
+foreach( SHARD full 0 1 )
+  if( SHARD STREQUAL full )
+    set( SHARD_OPT "" )
+  else()
+    set( SHARD_OPT --shard ${SHARD}/2:line )
+  endif()
+  execute_process( COMMAND ${TEST_PROG} --cfg ${SOURCEDIR}/rawimg.cfg --overwrite --outdir test_shards/${SHARD} --imgext pgm --regproc=false --savexml ${SHARD_OPT} ${SOURCEDIR}/test/test-lines.xml
+                   RESULT_VARIABLE HAD_ERROR )
+  if( HAD_ERROR )
+      message( FATAL_ERROR "Test failed - extraction of shard ${SHARD}" )
+  endif()
+endforeach()
+
+# Each shard must have annotated only its own lines
+set( LINES_0 r1_l1 r1_l2 )
+set( LINES_1 r2_l1 r2_l2 )
+foreach( SHARD 0 1 )
+  file( READ test_shards/${SHARD}/test-lines.xml XML )
+  foreach( LINE r1_l1 r1_l2 r2_l1 r2_l2 )
+    list( FIND LINES_${SHARD} ${LINE} OWN )
+    if( XML MATCHES "<TextLine id=\"${LINE}\">[ \t\r\n]*<Property key=\"slope\"" )
+      set( ANNOTATED 1 )
+    else()
+      set( ANNOTATED 0 )
+    endif()
+    if( ( OWN LESS 0 AND ANNOTATED ) OR ( NOT OWN LESS 0 AND NOT ANNOTATED ) )
+        message( FATAL_ERROR "Test failed - shard ${SHARD} has unexpected annotation state for line ${LINE}" )
+    endif()
+  endforeach()
+endforeach()
+
+execute_process( COMMAND ${TEST_PROG} --merge --outdir test_shards/merged test_shards/0 test_shards/1
+                 RESULT_VARIABLE HAD_ERROR )
+if( HAD_ERROR )
+    message( FATAL_ERROR "Test failed - merge of shards" )
+endif()
+
+execute_process( COMMAND diff test_shards/full/test-lines.xml test_shards/merged/test-lines.xml
+                 RESULT_VARIABLE DIFFERENT )
+if( DIFFERENT )
+    message( FATAL_ERROR "Test failed - merged xml file differs from the unsharded one" )
+endif()
+
+execute_process( COMMAND rm -r test_shards )
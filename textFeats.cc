@@ -1,15 +1,11 @@
 /**
  * Tool that extracts text feature vectors for a given Page XMLs or images
  *
- * @version $Version: 2019.10.24$
+ * @version $Version: 2026.10.17$
  * @copyright Copyright (c) 2016-present, Mauricio Villegas <mauricio_ville@yahoo.com>
  * @license MIT License
  */
 
-/*
- @todo Better parallelization: i.e. threads also read pages
-*/
-
 /*** Includes *****************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
@@ -20,18 +16,38 @@
 #include <libconfig.h++>
 #include <regex>
 #include <chrono>
+#include <deque>
+#include <map>
+#include <atomic>
 #include <sys/stat.h>
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
 
 #include "TextFeatExtractor.h"
 #include "PageXML.h"
+#include "FeatArchive.h"
+#include "ArkWriter.h"
+#include "Tracer.h"
+#include "FeatCache.h"
+#include "quant.h"
 #include "log.h"
 
+#if defined (__PAGEXML_MAGICK__)
+#include <Magick++.h>
+#endif
+
 using namespace std;
 using namespace libconfig;
 
 /*** Definitions **************************************************************/
 static char tool[] = "textFeats";
-static char version[] = "Version: 2019.10.24";
+static char version[] = "Version: 2026.10.17";
 
 struct FeatInfo {
   int num;
@@ -41,6 +57,94 @@ struct FeatInfo {
   vector<cv::Point2f> fpgram;
 };
 
+enum {
+  FEAT_PENDING = 0,
+  FEAT_EXTRACTED,
+  FEAT_SKIPPED,
+  FEAT_FAILED
+};
+
+/**
+ * A client of the server mode, stdin and stdout being also one.
+ */
+struct Client {
+  FILE *in;                    // Stream from which requests are read
+  FILE *out;                   // Stream to which replies are written
+  pthread_mutex_t mutex;       // Mutex for writing replies
+  int pending;                 // Number of requests not yet replied
+  bool eof;                    // Whether all requests have been read
+};
+
+/**
+ * A set of input files with their output options, given either in the
+ * command line or as a request in server mode.
+ */
+struct Request {
+  Client *client;              // Client to reply to, NULL for the command line
+  string outdir;               // Output directory
+  bool savexml;                // Whether to save XML with extraction information
+  string savexmldir;           // Directory for the extraction XML, empty for outdir
+  int numjobs;                 // Number of jobs not yet finalized
+  int numextract;              // Number of extracted samples
+  int numskipped;              // Number of skipped samples
+  int numfailed;               // Number of failed samples
+  bool failure;                // Whether anything of the request failed
+};
+
+/**
+ * An input unit: either a Page XML file or a group of consecutive line images.
+ */
+struct InputJob {
+  int num;                     // Number of the first file of the job
+  vector<string> fnames;       // Input file names
+  Request *req;                // Request to which the job belongs
+  bool isxml;                  // Whether the job is a Page XML
+  bool loaded;                 // Whether the reader finished loading the job
+  bool failed;                 // Whether loading failed
+  atomic<bool> failure;        // Whether anything of the job failed, set from any thread
+  bool finished;               // Whether all lines of the job were processed
+  bool join_nth;               // Whether features are joined by parent
+  bool lazy;                   // Whether lines are cropped by the extraction threads
+  pthread_mutex_t cropmutex;   // Serializes lazy cropping of lines of the page
+  long long pagebytes;         // Memory of the page images, accounted while the job is alive
+  string xpath;                // Selector of the lines of the job
+  int pending;                 // Number of lines not yet processed
+  PageXML *page;               // Page XML object, NULL for image jobs
+  FeatArchive *archive;        // Archive for the features, NULL for separate files
+  vector<NamedImage> images;   // Cropped lines or read line images
+  vector<bool> join_write;     // Whether a line is the last of its join group
+  vector<int> join_group;      // Join group of each line
+  vector<int> join_pending;    // Number of lines of each join group not yet processed
+  vector<bool> join_written;   // Whether the features of each join group were written
+  vector<vector<cv::Mat> > joinfeats; // Features of each line (one per perturbation) to be joined
+  vector<int> reppending;      // Number of perturbation replicas of each line not yet processed
+  vector<FeatInfo> featinfo;   // Extraction information of each line
+  vector<char> featstat;       // Extraction status of each line
+  vector<vector<string> > arkrecs; // Kaldi ark records of each line for ordered output
+  vector<int> failedwrites;    // Lines for which a queued write failed
+};
+
+/**
+ * A line of a job to be processed by the extraction threads.
+ */
+struct WorkItem {
+  InputJob *job;
+  int line;
+  int rep;                     // Perturbation replica to extract, -1 for the whole line
+};
+
+/**
+ * A features matrix or an image to be written to a file.
+ */
+struct WriteItem {
+  InputJob *job;               // Job to which the line belongs
+  int line;                    // Line of the job
+  string fname;                // Output file name
+  bool isimage;                // Whether to write the image instead of the features
+  cv::Mat feats;               // Features to write
+  PageImage image;             // Image to write
+};
+
 FILE *logfile = NULL;
 int verbosity = 1;
 
@@ -70,27 +174,89 @@ char  *gb_savexmldir = NULL;
 bool   gb_fpoints = true;
 int    gb_numrand = 0;
 bool   gb_firstrand = false;
+unsigned long gb_seed = 0;
 bool   gb_join = false;
-bool   gb_join_nth = false;
-vector<bool> gb_join_write;
+int    gb_numreaders = 1;
+int    gb_lookahead = 2;
+bool   gb_serve = false;
+char  *gb_socket = NULL;
+bool   gb_archive = false;
+char  *gb_archivefile = NULL;
+char   gb_default_archext[] = "tfa";
+char  *gb_arkfile = NULL;
+char  *gb_scpfile = NULL;
+bool   gb_arkorder = false;
+int    gb_quant = FEAT_RAW;
+bool   gb_listarchive = false;
+int    gb_numwriters = 0;
+bool   gb_lazycrop = false;
+int    gb_maxmem = 0;
+bool   gb_trace = false;
+char  *gb_tracefile = NULL;
+char  *gb_metricsfile = NULL;
+int    gb_metricsinterval = 10;
+int    gb_shard = 0;
+int    gb_numshards = 0;
+bool   gb_shardlines = false;
+bool   gb_merge = false;
+char  *gb_cachedir = NULL;
+char  *gb_rastercache = NULL;
+char   gb_rastercachepath[PATH_MAX];
+int    gb_numrasterizers = 0;
+int    gb_writequeue_max = 64;
 
 int                  gb_numthreads = 1;
 int                 *gb_threadnum = NULL;
 pthread_t           *gb_threads = NULL;
 pthread_mutex_t      gb_mutex = PTHREAD_MUTEX_INITIALIZER;
-unsigned             gb_next_image = 0;
-vector<NamedImage>   gb_images = vector<NamedImage>();
-vector<FeatInfo>     gb_featinfo = vector<FeatInfo>();
-vector<int>          gb_featskip = vector<int>();
-vector<int>          gb_featfail = vector<int>();
+pthread_cond_t       gb_workcond = PTHREAD_COND_INITIALIZER;
+deque<WorkItem>      gb_workqueue = deque<WorkItem>();
+bool                 gb_nomorework = false;
+pthread_cond_t       gb_memcond = PTHREAD_COND_INITIALIZER;
+int                  gb_inflight = 0;
+atomic<long long>    gb_heldbytes(0);
+long                 gb_numlines = 0;
+double              *gb_busytime = NULL;
 int                  gb_numextract = 0;
 int                  gb_numskipped = 0;
 int                  gb_numfailed = 0;
-bool                 gb_isxml;
 bool                 gb_failure = false;
 
 TextFeatExtractor   *gb_extractor = NULL;
-PageXML             *gb_page = NULL;
+FeatArchive         *gb_runarchive = NULL;
+ArkWriter           *gb_ark = NULL;
+Tracer              *gb_tracer = NULL;
+FeatCache           *gb_cache = NULL;
+string               gb_cacheconf;
+int                  gb_cachehits = 0;
+int                  gb_cachemisses = 0;
+
+pthread_t           *gb_readers = NULL;
+pthread_t           *gb_writers = NULL;
+pthread_mutex_t      gb_writemutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t       gb_writecond = PTHREAD_COND_INITIALIZER;
+pthread_cond_t       gb_writespacecond = PTHREAD_COND_INITIALIZER;
+deque<WriteItem>     gb_writequeue = deque<WriteItem>();
+bool                 gb_nomorewrites = false;
+double               gb_writetime = 0.0;
+double               gb_writewait = 0.0;
+double               gb_writebytes = 0.0;
+pthread_mutex_t      gb_jobmutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t       gb_jobcond = PTHREAD_COND_INITIALIZER;
+deque<InputJob*>     gb_jobs = deque<InputJob*>();
+int                  gb_jobbase = 0;
+int                  gb_next_job = 0;
+int                  gb_numfiles = 0;
+int                  gb_numpages = 0;
+bool                 gb_endinput = false;
+int                  gb_sockfd = -1;
+pthread_mutex_t      gb_metricsmutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t       gb_metricscond = PTHREAD_COND_INITIALIZER;
+bool                 gb_endmetrics = false;
+
+regex                gb_reXml(".+\\.xml",regex_constants::icase);
+regex                gb_reBase1(".*/([^/]+)\\.[^.]+");
+regex                gb_reBase2("(.+)\\.[^.]+");
 
 enum {
   OPTION_HELP      = 'h',
@@ -118,7 +284,29 @@ enum {
   OPTION_FPOINTS        ,
   OPTION_NUMRAND        ,
   OPTION_JOIN           ,
-  OPTION_FIRSTRAND
+  OPTION_FIRSTRAND      ,
+  OPTION_READERS        ,
+  OPTION_LOOKAHEAD      ,
+  OPTION_SERVER         ,
+  OPTION_ARCHIVE        ,
+  OPTION_ARK            ,
+  OPTION_SCP            ,
+  OPTION_ARKORDER       ,
+  OPTION_WRITERS        ,
+  OPTION_WRITEQUEUE     ,
+  OPTION_LAZYCROP       ,
+  OPTION_MAXMEM         ,
+  OPTION_TRACE          ,
+  OPTION_METRICS        ,
+  OPTION_METRICSINT     ,
+  OPTION_SHARD          ,
+  OPTION_MERGE          ,
+  OPTION_CACHE          ,
+  OPTION_SEED           ,
+  OPTION_QUANTIZE       ,
+  OPTION_RASTERCACHE    ,
+  OPTION_RASTERIZERS    ,
+  OPTION_LISTARCHIVE
 };
 
 static char gb_short_options[] = "hvVT:C:Oo:L";
@@ -139,6 +327,8 @@ static struct option gb_long_options[] = {
     { "xpath",       required_argument, NULL, OPTION_XPATH },
     { "basexpath",   required_argument, NULL, OPTION_BASEXPATH },
     { "density",     required_argument, NULL, OPTION_DENSITY },
+    { "rastercache", required_argument, NULL, OPTION_RASTERCACHE },
+    { "rasterizers", required_argument, NULL, OPTION_RASTERIZERS },
     { "skipwide",    required_argument, NULL, OPTION_SKIPWIDE },
     { "saveclean",   optional_argument, NULL, OPTION_SAVECLEAN },
     { "savefeaimg",  optional_argument, NULL, OPTION_SAVEFEAIMG },
@@ -149,6 +339,26 @@ static struct option gb_long_options[] = {
     { "rand",        required_argument, NULL, OPTION_NUMRAND },
     { "firstrand",   optional_argument, NULL, OPTION_FIRSTRAND },
     { "join",        optional_argument, NULL, OPTION_JOIN },
+    { "readers",     required_argument, NULL, OPTION_READERS },
+    { "lookahead",   required_argument, NULL, OPTION_LOOKAHEAD },
+    { "server",      optional_argument, NULL, OPTION_SERVER },
+    { "archive",     optional_argument, NULL, OPTION_ARCHIVE },
+    { "ark",         required_argument, NULL, OPTION_ARK },
+    { "scp",         required_argument, NULL, OPTION_SCP },
+    { "arkorder",    optional_argument, NULL, OPTION_ARKORDER },
+    { "writers",     required_argument, NULL, OPTION_WRITERS },
+    { "writequeue",  required_argument, NULL, OPTION_WRITEQUEUE },
+    { "lazycrop",    optional_argument, NULL, OPTION_LAZYCROP },
+    { "max-mem",     required_argument, NULL, OPTION_MAXMEM },
+    { "trace",       optional_argument, NULL, OPTION_TRACE },
+    { "metrics",     required_argument, NULL, OPTION_METRICS },
+    { "metrics-interval", required_argument, NULL, OPTION_METRICSINT },
+    { "shard",       required_argument, NULL, OPTION_SHARD },
+    { "merge",       no_argument,       NULL, OPTION_MERGE },
+    { "cache",       required_argument, NULL, OPTION_CACHE },
+    { "seed",        required_argument, NULL, OPTION_SEED },
+    { "quantize",    required_argument, NULL, OPTION_QUANTIZE },
+    { "list-archive",no_argument,       NULL, OPTION_LISTARCHIVE },
     { 0, 0, 0, 0 }
   };
 
@@ -157,11 +367,29 @@ void print_usage( FILE *file ) {
   fprintf( file, "Description: Extracts text features for given Page XMLs or images\n" );
   fprintf( file, "Usage 1: %s [options] <page1.xml> [<page2.xml> ...]\n", tool );
   fprintf( file, "Usage 2: %s [options] <textimage1> [<textimage2> ...]\n", tool );
+  fprintf( file, "Usage 3: %s [options] --server[=SOCKET]\n", tool );
+  fprintf( file, "Server mode reads requests from stdin or the UNIX socket, one per line, each\n" );
+  fprintf( file, "being a whitespace separated list of input files, optionally preceded by\n" );
+  fprintf( file, "--outdir=OUTDIR and --savexml[=DIR]. Each reply is the features list followed\n" );
+  fprintf( file, "by a line '# ok|failed extracted=N skipped=N failed=N' or '# error MESSAGE'.\n" );
+  fprintf( file, "A Page XML can be given as '-' to read it from stdin (not in server mode).\n" );
   fprintf( file, "Options:\n" );
   fprintf( file, " -h --help                      Print this usage information and exit\n" );
   fprintf( file, " -v --version                   Print tool version and exit\n" );
   fprintf( file, " -V --verbose[=(-|+|level)]     Verbosity level (def.=%d)\n", verbosity );
   fprintf( file, " -T --threads NUM               Number of parallel threads (def.=%d)\n", gb_numthreads );
+  fprintf( file, "    --readers NUM               Number of threads that load pages ahead (def.=%d)\n", gb_numreaders );
+  fprintf( file, "    --lookahead NUM             Maximum number of pages loaded ahead of extraction (def.=%d)\n", gb_lookahead );
+  fprintf( file, "    --writers NUM               Number of threads that write files, 0 to write in extraction threads (def.=%d)\n", gb_numwriters );
+  fprintf( file, "    --writequeue NUM            Maximum number of files waiting to be written (def.=%d)\n", gb_writequeue_max );
+  fprintf( file, "    --lazycrop[=(true|false)]   Crop lines when extracted instead of all when the page is read (def.=%s)\n", strbool(gb_lazycrop) );
+  fprintf( file, "    --max-mem MB                Budget for page and line images held, throttles reading and cropping, implies --lazycrop (def.=%s)\n", gb_maxmem ? to_string(gb_maxmem).c_str() : "unlimited" );
+  fprintf( file, "    --trace[=FILE]              Time processing stages, print summary and write Chrome trace to FILE (def.=%s)\n", strbool(gb_trace) );
+  fprintf( file, "    --metrics FILE              Periodically write progress metrics in Prometheus text format (def.=none)\n" );
+  fprintf( file, "    --metrics-interval SEC      Seconds between metrics updates (def.=%d)\n", gb_metricsinterval );
+  fprintf( file, "    --shard I/N[:(page|line)]   Only process shard I (from 0) of N, split by input file or by lines of each page and line image (def.=none)\n" );
+  fprintf( file, "    --merge                     Merge the extraction XMLs in the given shard directories into --savexml DIR or --outdir\n" );
+  fprintf( file, "    --cache DIR                 Reuse features of unchanged lines from a persistent cache in DIR (def.=none)\n" );
   fprintf( file, " -C --cfg CFGFILE               Configuration file for TextFeatExtractor and PageXML (def.=none)\n" );
   fprintf( file, " -O --overwrite[=(true|false)]  Overwrite existing files (def.=%s)\n", strbool(gb_overwrite) );
   fprintf( file, " -o --outdir OUTDIR             Output directory (def.=%s)\n", gb_outdir );
@@ -170,9 +398,17 @@ void print_usage( FILE *file ) {
   fprintf( file, "    --onlyid[=(true|false)]     Whether to only use ids for extracted feature names (def.=%s)\n", strbool(gb_onlyid) );
   fprintf( file, "    --feaext EXT                Output features file extension (def.=%s)\n", gb_feaext );
   fprintf( file, "    --imgext EXT                Output images file extension (def.=%s)\n", gb_imgext );
+  fprintf( file, "    --archive[=FILE]            Write features to indexed archives, one per input or all to FILE (def.=%s)\n", strbool(gb_archive) );
+  fprintf( file, "    --ark FILE                  Write features as a Kaldi binary ark to FILE or pipe, '-' for stdout (def.=none)\n" );
+  fprintf( file, "    --scp FILE                  Write Kaldi scp with the ark byte offsets (def.=none)\n" );
+  fprintf( file, "    --arkorder[=(true|false)]   Write ark records in input order instead of as extracted (def.=%s)\n", strbool(gb_arkorder) );
+  fprintf( file, "    --quantize (none|f16|u16|u8) Encoding of archive and ark features, f16 only for archives (def.=%s)\n", featEncodingName(gb_quant) );
+  fprintf( file, "    --list-archive              Read and decode the given archives, printing key, rows and cols of each record\n" );
   fprintf( file, "    --xpath XPATH               xpath for selecting text samples (def.=%s)\n", gb_xpath );
   fprintf( file, "    --basexpath XPATH           xpath for getting the XML base string (def.=use image basename)\n" );
   fprintf( file, "    --density DENSITY           Density for pdf to image conversion (def.=unspecified)\n" );
+  fprintf( file, "    --rasterizers NUM           Number of threads that rasterize pdf pages of a Page XML into --rastercache, 0 for -T (def.=%d)\n", gb_numrasterizers );
+  fprintf( file, "    --rastercache DIR           Reuse pdf pages rasterized in previous runs from a cache in DIR (def.=none)\n" );
   fprintf( file, "    --skipwide MAX_WIDTH        Whether to skip writing images wider than given width (def.=false)\n" );
   fprintf( file, "    --saveclean[=(true|false)]  Save clean images (def.=%s)\n", strbool(gb_saveclean) );
   fprintf( file, "    --savefeaimg[=(true|false)] Save features images (def.=%s)\n", strbool(gb_savefeaimg) );
@@ -182,7 +418,9 @@ void print_usage( FILE *file ) {
   fprintf( file, "    --fpoints[=(true|false)]    Store feature contours in points attribute (def.=%s)\n", strbool(gb_fpoints) );
   fprintf( file, "    --rand NUM                  Number of random perturbed extractions per sample (def.=%d)\n", gb_numrand );
   fprintf( file, "    --firstrand[=(true|false)]  Whether the first extraction is perturbed (def.=%s)\n", strbool(gb_firstrand) );
+  fprintf( file, "    --seed NUM                  Seed of the random perturbations, combined with line name and replica (def.=%lu)\n", gb_seed );
   fprintf( file, "    --join[=(true|false)]       Joins features with common parent for xml input (def.=%s)\n", strbool(gb_join) );
+  fprintf( file, "    --server[=SOCKET]           Serve requests from stdin or a UNIX socket (def.=%s)\n", strbool(gb_serve) );
   fprintf( file, "Default configuration file values:\n" );
   TextFeatExtractor extractor;
   if( gb_cfgfile != NULL ) {
@@ -201,6 +439,69 @@ inline float time_diff( chrono::high_resolution_clock::time_point tm ) {
   return 0.001*chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now()-tm).count();
 }
 
+/**
+ * Returns the current resident memory of the process in MB, 0 if unknown.
+ */
+inline float current_rss() {
+  long pages = 0;
+  FILE *statm = fopen( "/proc/self/statm", "r" );
+  if( statm == NULL )
+    return 0;
+  if( fscanf( statm, "%*d %ld", &pages ) != 1 )
+    pages = 0;
+  fclose( statm );
+  return pages*(sysconf(_SC_PAGESIZE)/1048576.0);
+}
+
+/**
+ * Returns the approximate memory in bytes of the pixels of an image.
+ */
+inline long long image_bytes( const PageImage& image ) {
+#if defined (__PAGEXML_IMG_MAGICK__)
+  return (long long)image.columns()*image.rows()*4*sizeof(Magick::Quantum);
+#elif defined (__PAGEXML_IMG_CV__)
+  return (long long)image.total()*image.elemSize();
+#endif
+}
+
+/**
+ * Whether the page and line images held exceed the --max-mem budget.
+ */
+inline bool over_budget() {
+  return gb_maxmem > 0 && gb_heldbytes > (long long)gb_maxmem*1048576 ;
+}
+
+/**
+ * Accounts memory of images being held (positive) or released (negative),
+ * waking up readers and extraction threads waiting for memory on release.
+ */
+void hold_bytes( long long bytes ) {
+  gb_heldbytes += bytes;
+  if( bytes >= 0 || gb_maxmem == 0 )
+    return;
+  pthread_mutex_lock( &gb_mutex );
+  pthread_cond_broadcast( &gb_memcond );
+  pthread_mutex_unlock( &gb_mutex );
+  pthread_mutex_lock( &gb_jobmutex );
+  pthread_cond_broadcast( &gb_jobcond );
+  pthread_mutex_unlock( &gb_jobmutex );
+}
+
+/**
+ * Returns the start time of a traced span, 0 if tracing is disabled.
+ */
+inline int64_t trace_start() {
+  return gb_tracer != NULL ? gb_tracer->now() : 0;
+}
+
+/**
+ * Records a span of a processing stage if tracing is enabled.
+ */
+inline void trace_end( const char* stage, int64_t start, const char* page = NULL, const char* line = NULL ) {
+  if( gb_tracer != NULL )
+    gb_tracer->span( stage, start, page, line );
+}
+
 inline bool parse_bool( char* str ) {
   if( str ) {
     if( !strcasecmp("true",str) || !strcasecmp("yes",str) )
@@ -286,6 +587,88 @@ int main( int argc, char *argv[] ) {
       case OPTION_THREADS:
         gb_numthreads = atoi(optarg);
         break;
+      case OPTION_READERS:
+        gb_numreaders = atoi(optarg);
+        break;
+      case OPTION_LOOKAHEAD:
+        gb_lookahead = atoi(optarg);
+        break;
+      case OPTION_ARCHIVE:
+        gb_archive = true;
+        if( optarg )
+          gb_archivefile = optarg;
+        break;
+      case OPTION_ARK:
+        gb_arkfile = optarg;
+        break;
+      case OPTION_SCP:
+        gb_scpfile = optarg;
+        break;
+      case OPTION_ARKORDER:
+        gb_arkorder = parse_bool(optarg);
+        break;
+      case OPTION_QUANTIZE:
+        gb_quant = featEncoding(optarg);
+        if( gb_quant < 0 )
+          die( "error: expected --quantize (none|f16|u16|u8), f16 requires OpenCV >= 3.2: %s", optarg );
+        break;
+      case OPTION_LISTARCHIVE:
+        gb_listarchive = true;
+        break;
+      case OPTION_WRITERS:
+        gb_numwriters = atoi(optarg);
+        break;
+      case OPTION_WRITEQUEUE:
+        gb_writequeue_max = atoi(optarg);
+        break;
+      case OPTION_LAZYCROP:
+        gb_lazycrop = parse_bool(optarg);
+        break;
+      case OPTION_MAXMEM:
+        gb_maxmem = atoi(optarg);
+        if( gb_maxmem > 0 )
+          gb_lazycrop = true;
+        break;
+      case OPTION_TRACE:
+        gb_trace = true;
+        gb_tracefile = optarg;
+        break;
+      case OPTION_METRICS:
+        gb_metricsfile = optarg;
+        break;
+      case OPTION_METRICSINT:
+        gb_metricsinterval = atoi(optarg);
+        break;
+      case OPTION_SHARD:
+        {
+          char by[8] = "page";
+          if( sscanf( optarg, "%d/%d:%7s", &gb_shard, &gb_numshards, by ) < 2 ||
+              gb_numshards < 1 || gb_shard < 0 || gb_shard >= gb_numshards ||
+              ( strcmp(by,"page") && strcmp(by,"line") ) )
+            die( "error: expected --shard I/N[:(page|line)] with 0 <= I < N: %s", optarg );
+          gb_shardlines = ! strcmp(by,"line");
+        }
+        break;
+      case OPTION_MERGE:
+        gb_merge = true;
+        break;
+      case OPTION_CACHE:
+        gb_cachedir = optarg;
+        break;
+      case OPTION_RASTERCACHE:
+        gb_rastercache = optarg;
+        break;
+      case OPTION_RASTERIZERS:
+        gb_numrasterizers = atoi(optarg);
+        break;
+      case OPTION_SEED:
+        gb_seed = strtoul(optarg,NULL,10);
+        break;
+      case OPTION_SERVER:
+        gb_serve = true;
+        if( optarg )
+          gb_socket = optarg;
+        break;
       case OPTION_VERBOSE:
         if( ! optarg )
           verbosity ++;
@@ -304,13 +687,58 @@ int main( int argc, char *argv[] ) {
         fprintf( stderr, "%s %s\n", tool, version+9 );
         PageXML::printVersions(stderr);
         fprintf( stderr, "compiled against TextFeatExtractor %s\n", TextFeatExtractor::version() );
+#if defined (__PAGEXML_IMG_CV__)
+        fprintf( stderr, "image backend: OpenCV\n" );
+#else
+        fprintf( stderr, "image backend: Magick++\n" );
+#endif
         return SUCCESS;
       default:
         die( "error: incorrect input argument: %s", argv[optind-1] );
     }
 
-  if( optind >= argc )
+  if( optind >= argc && ! gb_serve )
     die( "error: expected at least one Page XML or line image file" );
+  if( optind < argc && gb_serve )
+    die( "error: input files are not accepted in server mode" );
+  if( gb_arkfile != NULL && gb_archive )
+    die( "error: --ark and --archive can't be used at the same time" );
+  if( gb_scpfile != NULL && gb_arkfile == NULL )
+    die( "error: --scp requires --ark" );
+  if( gb_arkfile != NULL && ! strcmp(gb_arkfile,"-") && ( gb_baselist || gb_featlist || gb_serve ) )
+    die( "error: ark to stdout not possible with features lists or server mode" );
+  if( gb_shardlines && gb_join )
+    die( "error: --join is not possible with sharding by lines" );
+  if( gb_rastercache != NULL && ! gb_density )
+    die( "error: --rastercache requires --density" );
+  if( gb_quant != FEAT_RAW && gb_arkfile == NULL && ! gb_archive )
+    die( "error: --quantize requires --archive or --ark" );
+  if( gb_quant == FEAT_F16 && gb_arkfile != NULL )
+    die( "error: Kaldi ark has no float16 matrices, use --quantize u16 or u8" );
+
+  /// List contents of archives ///
+  if( gb_listarchive ) {
+    if( gb_serve )
+      die( "error: --list-archive is not possible in server mode" );
+    int listArchives( vector<string>& fnames ); // Defined below
+    vector<string> fnames( argv+optind, argv+argc );
+    return listArchives( fnames );
+  }
+
+  /// Merge extraction XMLs of shards ///
+  if( gb_merge ) {
+    if( gb_serve )
+      die( "error: --merge is not possible in server mode" );
+    int mergeShards( vector<string>& dirs, string outdir ); // Defined below
+    vector<string> dirs( argv+optind, argv+argc );
+    return mergeShards( dirs, gb_savexmldir != NULL ? gb_savexmldir : gb_outdir );
+  }
+
+#if defined (__PAGEXML_MAGICK__)
+  /// Keep Magick from starting its own threads, parallelism is given by -T ///
+  if( gb_numthreads > 1 )
+    MagickCore::SetMagickResourceLimit( MagickCore::ThreadResource, 1 );
+#endif
 
   /// Print configuration ///
   logger( 3, "config: overwrite files: %s", strbool(gb_overwrite) );
@@ -347,172 +775,275 @@ int main( int argc, char *argv[] ) {
   gb_extractor = &extractor;
   char *feaext = gb_extractor->isImageFormat() ? gb_imgext : gb_feaext ;
 
-  /// Create page loader object ///
-  PageXML page;
-  //PageXML page(cfg);
-  ////page.loadConf( cfg );
-  //if( verbosity >= 3 )
-  //  page.printConf( logfile );
-  gb_page = &page;
-
   /// Auxiliary stuff ///
-  regex reXml(".+\\.xml",regex_constants::icase);
-  regex reBase1(".*/([^/]+)\\.[^.]+");
-  regex reBase2("(.+)\\.[^.]+");
-  chrono::high_resolution_clock::time_point tm;
   chrono::high_resolution_clock::time_point tottm = chrono::high_resolution_clock::now();
 
-  gb_threads = new pthread_t[gb_numthreads];
-  gb_threadnum = new int[gb_numthreads];
-  for( int n=0; n<gb_numthreads; n++ )
-    gb_threadnum[n] = n;
-
   if( gb_numrand > 1 )
     for( int n=0; n<gb_numrand; n++ )
       mkdir( (string(gb_outdir)+'/'+to_string(n)).c_str(), 0755 );
 
-  /// Loop for processing input files ///
-  for( int n=optind; n<argc; n++ ) {
-    gb_isxml = regex_match(argv[n],reXml);
-    // @todo Allow "-" for Page XML from stdin
-
-    gb_featinfo.clear();
-    gb_featskip.clear();
-    gb_featfail.clear();
-    gb_join_write.clear();
-    gb_join_nth = false;
-
-    /// Read Page XML file ///
-    if( gb_isxml ) {
-      logger( 1, "processing file %d: %s", n-optind+1, argv[n] );
-
-      tm = chrono::high_resolution_clock::now();
-      page.loadXml( argv[n] );
-      if( gb_regproc )
-        page.processStart(tool);
-      page.simplifyIDs();
-      if( gb_density )
-        page.loadImages( true, gb_density );
-      gb_images = page.crop( gb_xpath, NULL, true, NULL, gb_basexpath );
-      logger( 2, "page read and line cropping time: %.0f ms", time_diff(tm) );
-
-      if ( gb_join ) {
-        gb_join_nth = true;
-        gb_numthreads = 1;
-        gb_numrand = 0;
-        vector<xmlNodePt> sel = page.select(gb_xpath);
-        int num = sel.size();
-        gb_join_write.resize(num);
-        xmlNodePt prev = NULL;
-        for ( int k=num-1; k>=0; k-- ) {
-          gb_join_write[k] = sel[k]->parent->parent != prev ? true : false;
-          prev = sel[k]->parent->parent;
-        }
+  /// Open cache of extracted features, keyed also by the extractor configuration ///
+  if( gb_cachedir != NULL ) {
+    if( gb_numrand > 0 || gb_saveclean || gb_savefeaimg )
+      logger( 0, "warning: cache not used with --rand, --saveclean or --savefeaimg" );
+    else {
+      gb_cache = new FeatCache;
+      try {
+        gb_cache->open( gb_cachedir );
       }
+      catch( const std::exception& e ) {
+        die( "error: %s", e.what() );
+      }
+      char *conf = NULL;
+      size_t size = 0;
+      FILE *conffile = open_memstream( &conf, &size );
+      gb_extractor->printConf( conffile );
+      fclose( conffile );
+      gb_cacheconf = string(TextFeatExtractor::version())+'\n'+string(conf,size);
+      free( conf );
     }
+  }
 
-    /// Or read a set of input images ///
-    else {
-      gb_images.clear();
-      smatch base_match;
+  /// Open cache of rasterized pdf pages ///
+  if( gb_rastercache != NULL ) {
+    string dir = gb_rastercache;
+    for( size_t pos = dir.find('/',1); ; pos = dir.find('/',pos+1) ) {
+      string sub = dir.substr( 0, pos );
+      if( mkdir( sub.c_str(), 0755 ) && errno != EEXIST )
+        die( "error: unable to create directory: %s: %s", sub.c_str(), strerror(errno) );
+      if( pos == string::npos )
+        break;
+    }
+    if( realpath( gb_rastercache, gb_rastercachepath ) == NULL )
+      die( "error: unable to resolve raster cache directory: %s: %s", gb_rastercache, strerror(errno) );
+    gb_rastercache = gb_rastercachepath;
+  }
+  if( gb_numrasterizers <= 0 )
+    gb_numrasterizers = gb_numthreads;
+
+  /// Open archive for all features of the run ///
+  if( gb_archivefile != NULL ) {
+    if( ! gb_overwrite && file_exists(gb_archivefile) )
+      logger( 1, "appending to existing archive, replacing records of repeated keys: %s", gb_archivefile );
+    gb_runarchive = new FeatArchive;
+    try {
+      gb_runarchive->open( gb_archivefile, ! gb_overwrite );
+      gb_runarchive->setEncoding( gb_quant );
+    }
+    catch( const std::exception& e ) {
+      die( "error: %s", e.what() );
+    }
+  }
 
-      for( int m=n; m<min(argc,n+100); m++ ) {
-        string argvn = string(argv[m]);
-        string linename =
-          ( regex_match(argvn,base_match,reBase1) || regex_match(argvn,base_match,reBase2) ) ?
-          base_match[1].str() :
-          argvn ;
+  /// Open Kaldi ark output ///
+  if( gb_arkfile != NULL ) {
+    gb_ark = new ArkWriter;
+    try {
+      gb_ark->open( gb_arkfile, gb_scpfile );
+      gb_ark->setEncoding( gb_quant );
+    }
+    catch( const std::exception& e ) {
+      die( "error: %s", e.what() );
+    }
+  }
 
-        PageImage lineimg;
-#if defined (__PAGEXML_IMG_MAGICK__)
-        lineimg.read(argv[m]);
-#elif defined (__PAGEXML_IMG_CV__)
-        lineimg = cv::imread(argv[m]);
-#endif
+  /// Start tracing of processing stages ///
+  if( gb_trace ) {
+    gb_tracer = new Tracer;
+    try {
+      if( gb_tracefile != NULL )
+        gb_tracer->open( gb_tracefile );
+    }
+    catch( const std::exception& e ) {
+      die( "error: %s", e.what() );
+    }
+    gb_tracer->threadName( "main" );
+  }
 
-        NamedImage namedline;
-        namedline.id = namedline.name = linename;
-        namedline.image = lineimg;
-        gb_images.push_back(namedline);
-      }
+  /// Start reader threads that load jobs ahead of the extraction ///
+  gb_numreaders = max(1,gb_numreaders);
+  gb_lookahead = max(0,gb_lookahead);
+  gb_readers = new pthread_t[gb_numreaders];
+  xmlInitParser();
+  void* readerThread( void* ); // Defined below
+  for( int n=0; n<gb_numreaders; n++ )
+    pthread_create( &gb_readers[n], NULL, readerThread, NULL );
+
+  /// Start writer threads ///
+  gb_numwriters = max(0,gb_numwriters);
+  gb_writequeue_max = max(1,gb_writequeue_max);
+  gb_writers = new pthread_t[gb_numwriters];
+  void* writerThread( void* ); // Defined below
+  for( int n=0; n<gb_numwriters; n++ )
+    pthread_create( &gb_writers[n], NULL, writerThread, NULL );
+
+  /// Start the pool of extraction threads ///
+  gb_threads = new pthread_t[gb_numthreads];
+  gb_threadnum = new int[gb_numthreads];
+  void* extractionThread( void* _num ); // Defined below
+  gb_busytime = new double[gb_numthreads]();
+  for( int n=0; n<gb_numthreads; n++ ) {
+    gb_threadnum[n] = n;
+    pthread_create( &gb_threads[n], NULL, extractionThread, (void*)&gb_threadnum[n] );
+  }
 
-      n += (int)gb_images.size()-1;
-    }
+  /// Start thread that periodically writes progress metrics ///
+  pthread_t metrics_thread;
+  void* metricsThread( void* ); // Defined below
+  if( gb_metricsfile != NULL ) {
+    gb_metricsinterval = max(1,gb_metricsinterval);
+    pthread_create( &metrics_thread, NULL, metricsThread, NULL );
+  }
 
-    gb_next_image = 0;
+  /// Request of the command line ///
+  Request cmdreq = Request();
+  cmdreq.outdir = gb_outdir;
+  cmdreq.savexml = gb_savexml;
+  cmdreq.savexmldir = gb_savexmldir != NULL ? gb_savexmldir : "";
+
+  void addJobs( Request& req, vector<string>& files ); // Defined below
+  void* clientThread( void* _client ); // Defined below
+  void* serverThread( void* ); // Defined below
+
+  /// Jobs for the command line input files ///
+  if( ! gb_serve ) {
+    vector<string> files( argv+optind, argv+argc );
+    addJobs( cmdreq, files );
+    pthread_mutex_lock( &gb_jobmutex );
+    gb_endinput = true;
+    pthread_cond_broadcast( &gb_jobcond );
+    pthread_mutex_unlock( &gb_jobmutex );
+  }
 
-    /// Start threads and wait for them to finish ///
-    void* extractionThread( void* _num ); // Defined below
-    for( int n=gb_numthreads-1; n>=0; n-- )
-      pthread_create( &gb_threads[n], NULL, extractionThread, (void*)&gb_threadnum[n] );
-    for( int n=gb_numthreads-1; n>=0; n-- )
-      pthread_join( gb_threads[n], NULL );
+  /// Or serve requests from stdin ///
+  else if( gb_socket == NULL ) {
+    if( ! gb_baselist )
+      gb_featlist = true;
+    Client *client = new Client();
+    client->in = stdin;
+    client->out = stdout;
+    pthread_mutex_init( &client->mutex, NULL );
+    pthread_t thread;
+    pthread_create( &thread, NULL, clientThread, (void*)client );
+    pthread_detach( thread );
+  }
 
-    gb_numextract += gb_featinfo.size();
-    gb_numskipped += gb_featskip.size();
-    gb_numfailed += gb_featfail.size();
-    if( gb_images.size() > 0 && (int)gb_featinfo.size() == 0 )
-      gb_failure = true;
+  /// Or serve requests from a UNIX socket ///
+  else {
+    if( ! gb_baselist )
+      gb_featlist = true;
+    struct sockaddr_un addr;
+    memset( &addr, 0, sizeof(addr) );
+    addr.sun_family = AF_UNIX;
+    if( strlen(gb_socket) >= sizeof(addr.sun_path) )
+      die( "error: socket path too long: %s", gb_socket );
+    strcpy( addr.sun_path, gb_socket );
+    unlink( gb_socket );
+    gb_sockfd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if( gb_sockfd < 0 ||
+        bind( gb_sockfd, (struct sockaddr*)&addr, sizeof(addr) ) < 0 ||
+        listen( gb_sockfd, 16 ) < 0 )
+      die( "error: unable to listen on socket: %s", gb_socket );
+    signal( SIGPIPE, SIG_IGN );
+    logger( 1, "listening on socket: %s", gb_socket );
+    pthread_t thread;
+    pthread_create( &thread, NULL, serverThread, NULL );
+    pthread_detach( thread );
+  }
 
-    /// Extracted features list ///
-    if( ( gb_baselist || gb_featlist ) && ! gb_failure )
-      for( int kk=0; kk<(int)gb_featinfo.size(); kk++ ) {
-        int k = gb_featinfo[kk].num;
-        if ( ! gb_join_nth ) {
-          string imgname = gb_onlyid ? gb_images[k].id : gb_images[k].name;
-          if( gb_numrand < 2 )
-            printf( "%s\n", gb_baselist ? imgname.c_str() : (string(gb_outdir)+'/'+imgname+'.'+feaext).c_str() );
-          else
-            for( int r=0; r<gb_numrand; r++ )
-              if( gb_baselist )
-                printf( "%d/%s\n", r, imgname.c_str() );
-              else
-                printf( "%s/%d/%s.%s\n", gb_outdir, r, imgname.c_str(), feaext );
-        }
-        else if ( gb_join_write[k] ) {
-          string imgname = gb_page->getNodeName( gb_images[k].node->parent->parent );
-          printf( "%s\n", gb_baselist ? imgname.c_str() : (string(gb_outdir)+'/'+imgname+'.'+feaext).c_str() );
-        }
-      }
+  /// Loop that queues lines of loaded jobs and finalizes jobs in input order ///
+  void queueJob( InputJob& job ); // Defined below
+  void finalizeJob( InputJob& job, char *feaext ); // Defined below
+  int next_queue = 0;
+  while( true ) {
 
-    /// Save Page XML with feature extraction information ///
-    if( gb_isxml && gb_savexml && gb_images.size() > 0 ) {
-      string outfile = gb_xmlbasepath ? gb_page->getValue(gb_page->selectNth(gb_basexpath))+".xml" : string(argv[n]);
-      outfile = string(gb_savexmldir!=NULL?gb_savexmldir:gb_outdir)+'/'+regex_replace(outfile,regex(".*/"),"");
-      if( ! gb_overwrite && file_exists(outfile.c_str()) ) {
-        logger( 0, "error: aborted write to existing file: %s", outfile.c_str() );
-        gb_failure = true;
-      }
-      else {
-        for( int k=0; k<(int)gb_featfail.size(); k++ ) {
-          xmlNodePtr elem = gb_images[gb_featfail[k]].node->parent;
-          gb_page->setProperty( elem, "textFeats-failed" );
-        }
-        for( int k=0; k<(int)gb_featskip.size(); k++ ) {
-          xmlNodePtr elem = gb_images[gb_featskip[k]].node->parent;
-          gb_page->setProperty( elem, "textFeats-skipped" );
-        }
-        for( int k=0; k<(int)gb_featinfo.size(); k++ ) {
-          xmlNodePtr elem = gb_images[gb_featinfo[k].num].node->parent;
-          gb_page->setProperty( elem, "rotation", gb_images[gb_featinfo[k].num].rotation );
-          gb_page->setProperty( elem, "slope", gb_featinfo[k].slope );
-          gb_page->setProperty( elem, "slant", gb_featinfo[k].slant );
-          if( gb_featinfo[k].fcontour.size() > 0 ) {
-            if( gb_fpoints )
-              gb_page->setCoords( elem, gb_featinfo[k].fcontour );
-            else
-              gb_page->setProperty( elem, "fcontour", gb_page->pointsToString(gb_featinfo[k].fcontour).c_str() );
-          }
-          if( gb_featinfo[k].fpgram.size() > 0 )
-            gb_page->setProperty( elem, "fpgram", gb_page->pointsToString(gb_featinfo[k].fpgram).c_str() );
-        }
-        if( gb_regproc )
-          page.processEnd();
-        page.write( outfile.c_str() );
+    /// Queue lines of jobs as they get loaded until the first job is finished ///
+    pthread_mutex_lock( &gb_jobmutex );
+    while( true ) {
+      if( gb_jobs.size() > 0 && gb_jobs.front()->finished )
+        break;
+      if( gb_jobs.size() == 0 && gb_endinput )
+        break;
+      if( next_queue < gb_jobbase+(int)gb_jobs.size() && gb_jobs[next_queue-gb_jobbase]->loaded ) {
+        InputJob *queued = gb_jobs[next_queue-gb_jobbase];
+        next_queue++;
+        pthread_mutex_unlock( &gb_jobmutex );
+        queueJob( *queued );
+        pthread_mutex_lock( &gb_jobmutex );
+        continue;
       }
+      pthread_cond_wait( &gb_jobcond, &gb_jobmutex );
+    }
+    if( gb_jobs.size() == 0 ) {
+      pthread_mutex_unlock( &gb_jobmutex );
+      break;
+    }
+    InputJob *job = gb_jobs.front();
+    pthread_mutex_unlock( &gb_jobmutex );
+
+    int64_t trace_tm = trace_start();
+    finalizeJob( *job, feaext );
+    trace_end( "finalize", trace_tm, job->fnames[0].c_str() );
+
+    /// Release job and let readers continue ///
+    pthread_mutex_lock( &gb_jobmutex );
+    gb_jobs.pop_front();
+    gb_jobbase++;
+    pthread_cond_broadcast( &gb_jobcond );
+    pthread_mutex_unlock( &gb_jobmutex );
+    delete job->page;
+    hold_bytes( -job->pagebytes );
+    if( job->archive != gb_runarchive )
+      delete job->archive;
+    pthread_mutex_destroy( &job->cropmutex );
+    delete job;
+  }
+
+  /// Stop extraction threads ///
+  pthread_mutex_lock( &gb_mutex );
+  gb_nomorework = true;
+  pthread_cond_broadcast( &gb_workcond );
+  pthread_mutex_unlock( &gb_mutex );
+  for( int n=0; n<gb_numthreads; n++ )
+    pthread_join( gb_threads[n], NULL );
+
+  for( int n=0; n<gb_numreaders; n++ )
+    pthread_join( gb_readers[n], NULL );
+
+  /// Stop writer threads ///
+  pthread_mutex_lock( &gb_writemutex );
+  gb_nomorewrites = true;
+  pthread_cond_broadcast( &gb_writecond );
+  pthread_mutex_unlock( &gb_writemutex );
+  for( int n=0; n<gb_numwriters; n++ )
+    pthread_join( gb_writers[n], NULL );
+
+  /// Stop metrics thread, which does a last update ///
+  if( gb_metricsfile != NULL ) {
+    pthread_mutex_lock( &gb_metricsmutex );
+    gb_endmetrics = true;
+    pthread_cond_signal( &gb_metricscond );
+    pthread_mutex_unlock( &gb_metricsmutex );
+    pthread_join( metrics_thread, NULL );
+  }
+
+  if( cmdreq.failure )
+    gb_failure = true;
+
+  if( gb_runarchive != NULL ) {
+    try {
+      gb_runarchive->close();
+    }
+    catch( const std::exception& e ) {
+      logger( 0, "error: %s", e.what() );
+      gb_failure = true;
     }
-    else if( gb_savexml && ! gb_isxml )
-      logger( 0, "warning: requested to save xml but input is not xml" );
+    delete gb_runarchive;
+  }
+
+  if( gb_ark != NULL ) {
+    gb_ark->close();
+    delete gb_ark;
   }
 
   if( gb_numskipped > 0 )
@@ -524,162 +1055,1689 @@ int main( int argc, char *argv[] ) {
       logger( 0, "warning: %d failed extractions", gb_numfailed );
   }
   logger( 2, "extracted features for %d samples", gb_numextract );
+  logger( 2, "file writing time: %.0f ms (%d writer threads)", gb_writetime, gb_numwriters );
+  if( gb_numwriters > 0 )
+    logger( 2, "extraction threads waiting on full write queue: %.0f ms", gb_writewait );
   logger( 2, "total time: %.0f ms", time_diff(tottm) );
+  struct rusage usage;
+  if( ! getrusage( RUSAGE_SELF, &usage ) )
+    logger( 2, "peak memory (RSS): %.1f MB", usage.ru_maxrss/1024.0 );
+
+  if( gb_cache != NULL ) {
+    int lookups = gb_cachehits+gb_cachemisses;
+    logger( 1, "cache: %d hits, %d misses (%.1f%% hit rate)", gb_cachehits, gb_cachemisses, lookups ? 100.0*gb_cachehits/lookups : 0.0 );
+    delete gb_cache;
+  }
+
+  if( gb_tracer != NULL ) {
+    logger( 0, "stage timing summary:" );
+    gb_tracer->summary( logfile );
+    delete gb_tracer;
+  }
 
   /// Release resources ///
   xmlCleanupParser();
   pthread_mutex_destroy(&gb_mutex);
+  pthread_cond_destroy(&gb_workcond);
+  pthread_cond_destroy(&gb_memcond);
+  pthread_mutex_destroy(&gb_writemutex);
+  pthread_cond_destroy(&gb_writecond);
+  pthread_cond_destroy(&gb_writespacecond);
+  pthread_mutex_destroy(&gb_jobmutex);
+  pthread_cond_destroy(&gb_jobcond);
+  pthread_mutex_destroy(&gb_metricsmutex);
+  pthread_cond_destroy(&gb_metricscond);
+  delete[] gb_busytime;
   //pthread_exit(NULL); // hangs here, why?
 
   return gb_failure ? FAILURE : SUCCESS ;
 }
 
 /**
- * Function for parallel extraction of features with pthread.
+ * Splits the files of a request into jobs and adds them for processing.
  */
-void* extractionThread( void* _num ) {
-  int thread = *((int*)_num);
+void addJobs( Request& req, vector<string>& _files ) {
+
+  /// Keep only the files of the shard if sharding by page ///
+  /// (line images are split by their index among the images if sharding by lines) ///
+  vector<string> files;
+  for( int n=0, img=0; n<(int)_files.size(); n++ ) {
+    bool isxml = _files[n] == "-" || regex_match(_files[n],gb_reXml);
+    if( gb_numshards == 0 ||
+        ( gb_shardlines && isxml ) ||
+        ( gb_shardlines ? img : n ) % gb_numshards == gb_shard )
+      files.push_back(_files[n]);
+    if( ! isxml )
+      img++;
+  }
 
-  cv::Mat join_feats;
+  vector<InputJob*> jobs;
+  for( int n=0; n<(int)files.size(); n++ ) {
+    InputJob *job = new InputJob();
+    pthread_mutex_init( &job->cropmutex, NULL );
+    job->req = &req;
+    job->fnames.push_back(files[n]);
+    job->isxml = files[n] == "-" || regex_match(files[n],gb_reXml);
+    // Images are only named by the readers, reading is done by the extraction threads,
+    // so groups of up to 100 images just set how often features lists are printed
+    if( ! job->isxml )
+      while( job->fnames.size() < 100 && n+1 < (int)files.size() &&
+             files[n+1] != "-" && ! regex_match(files[n+1],gb_reXml) )
+        job->fnames.push_back(files[++n]);
+    jobs.push_back(job);
+  }
 
-  while( true ) {
+  /// Reply right away to a server request left without jobs ///
+  if( jobs.size() == 0 && req.client != NULL ) {
+    Client *client = req.client;
+    pthread_mutex_lock( &client->mutex );
+    fprintf( client->out, "# ok extracted=0 skipped=0 failed=0\n" );
+    fflush( client->out );
+    pthread_mutex_unlock( &client->mutex );
+    delete &req;
+    void releaseClient( Client *client, bool eof ); // Defined below
+    releaseClient( client, false );
+    return;
+  }
 
-    /// Thread safe selection of image to process ///
-    pthread_mutex_lock( &gb_mutex );
-    if( gb_next_image >= gb_images.size() ) {
-      pthread_mutex_unlock( &gb_mutex );
-      break;
-    }
-    int image_num = gb_next_image;
-    gb_next_image++;
-    pthread_mutex_unlock( &gb_mutex );
+  pthread_mutex_lock( &gb_jobmutex );
+  req.numjobs = jobs.size();
+  for( int n=0; n<(int)jobs.size(); n++ ) {
+    jobs[n]->num = gb_numfiles+1;
+    gb_numfiles += jobs[n]->fnames.size();
+    gb_jobs.push_back(jobs[n]);
+  }
+  pthread_cond_broadcast( &gb_jobcond );
+  pthread_mutex_unlock( &gb_jobmutex );
+}
 
-    /// Perform extraction ///
-    chrono::high_resolution_clock::time_point tm = chrono::high_resolution_clock::now();
-    string imgname = gb_onlyid ? gb_images[image_num].id : gb_images[image_num].name;
-    logger( 4, "extracting: %s (thread %d)", imgname.c_str(), thread );
+/**
+ * A pdf page to rasterize into the raster cache for a job.
+ */
+struct RasterItem {
+  int pagenum;                 // Page number in the Page XML
+  string source;               // Image file name, e.g. "/path/doc.pdf[3]"
+  string fname;                // Rasterized file in the cache
+  bool cached;                 // Whether fname was already in the cache
+  string error;                // Error message if rasterization failed
+};
 
-    try {
+/**
+ * State shared by the rasterization threads of a job.
+ */
+struct RasterWork {
+  vector<RasterItem> *items;
+  const char *pageid;
+  int next;
+  pthread_mutex_t mutex;
+};
 
-      float slope, slant;
-      vector<cv::Point2f> fpgram;
-      vector<cv::Point> fcontour;
+/**
+ * Function for rasterizing pdf pages with pthread, writes each page as a
+ * lossless image which is then loaded by PageXML in place of the pdf.
+ */
+void* rasterThread( void* _work ) {
+  RasterWork& work = *(RasterWork*)_work;
+  if( gb_tracer != NULL )
+    gb_tracer->threadName( "rasterizer" );
 
-      PageImage prepimage = gb_images[image_num].image;
+  while( true ) {
+    pthread_mutex_lock( &work.mutex );
+    int n = work.next++;
+    pthread_mutex_unlock( &work.mutex );
+    if( n >= (int)work.items->size() )
+      break;
+    RasterItem& item = (*work.items)[n];
+    if( item.cached )
+      continue;
 
-      /// Clean and enhance image ///
-      logger( 5, "preprocessing: %s (thread %d)", imgname.c_str(), thread );
-      gb_extractor->preprocess( prepimage, gb_savexml ? &fcontour : NULL );
-      if( gb_saveclean ) {
-        string outfile = string(gb_outdir)+'/'+imgname+"_clean."+gb_imgext;
-        if( ! gb_overwrite && file_exists(outfile.c_str()) ) {
-          logger( 0, "error: aborted write to existing file: %s", outfile.c_str() );
-          gb_failure = true;
-        }
-#if defined (__PAGEXML_IMG_MAGICK__)
-        prepimage.write( outfile.c_str() );
-#elif defined (__PAGEXML_IMG_CV__)
-        imwrite( outfile.c_str(), prepimage );
+    int64_t trace_tm = trace_start();
+    string tmpname = item.fname+".tmp"+to_string(getpid())+"_"+to_string((unsigned long)pthread_self())+".png";
+    try {
+#if defined (__PAGEXML_MAGICK__)
+      Magick::Image image;
+      image.density( Magick::Geometry( gb_density, gb_density ) );
+      image.read( item.source );
+      image.quality( 10 );
+      image.write( tmpname );
+      if( rename( tmpname.c_str(), item.fname.c_str() ) )
+        throw runtime_error( "unable to rename: "+tmpname );
+#else
+      throw runtime_error( "pdf rasterization requires Magick++" );
 #endif
-      }
+    }
+    catch( const std::exception& e ) {
+      item.error = e.what();
+      unlink( tmpname.c_str() );
+    }
+    trace_end( "rasterize", trace_tm, work.pageid, item.source.c_str() );
+  }
 
-      /// Estimate slope and slant (sets them to 0 if disabled) ///
-      logger( 5, "estimating angles: %s (thread %d)", imgname.c_str(), thread );
-      gb_extractor->estimateAngles( prepimage, &slope, &slant, gb_images[image_num].rotation );
+  return NULL;
+}
 
-      /// Get x-height ///
-      int xheight = 0;
-      if( gb_isxml )
-        xheight = gb_page->getXheight( gb_images[image_num].id.c_str() );
-      // @todo x-height estimation from image
-      //xheight = extractor.estimateXheight( prepimage );
-      //logger( 0, "xheight=%d", xheight );
+/**
+ * Adds the contents of a file to a hash, returns false if it can't be read.
+ */
+bool hashFile( FeatCache::Hash& hash, const string& fname ) {
+  FILE *file = fopen( fname.c_str(), "rb" );
+  if( file == NULL )
+    return false;
+  char buf[1<<16];
+  size_t len;
+  while( ( len = fread( buf, 1, sizeof(buf), file ) ) > 0 )
+    hash.update( buf, len );
+  fclose( file );
+  return true;
+}
 
-      /// Loop for random perturbation extractions ///
-      bool skipsample = false;
-      int R = gb_numrand == 0 ? 1 : gb_numrand ;
-      for( int r=0; r<R; r++ ) {
-        bool randpert = r > 0 || ( r == 0 && gb_firstrand ) ;
-        string outname = string(gb_outdir)+(gb_numrand>1?"/"+to_string(r):"")+"/"+imgname;
-        if ( gb_join_nth && gb_join_write[image_num] )
-          outname = string(gb_outdir)+"/"+gb_page->getNodeName( gb_images[image_num].node->parent->parent );
+/**
+ * Loads the images of the pages referenced by the selected lines at the given
+ * density. With a raster cache, pdf pages are taken from it or rasterized into
+ * it in parallel, otherwise all pages are loaded directly by PageXML.
+ */
+void loadPageImages( InputJob& job, PageXML& page ) {
+  const char *pageid = job.fnames[0].c_str();
+
+  /// Pages that have selected lines ///
+  vector<xmlNodePt> sel = page.select( job.xpath.c_str() );
+  vector<bool> needed( page.numPages(), false );
+  for( int k=0; k<(int)sel.size(); k++ )
+    needed[ page.getPageNumber(sel[k]) ] = true;
+
+  /// Directory of relative image paths ///
+  string xmldir = job.fnames[0] == "-" || job.fnames[0].find('/') == string::npos ? string(".") : job.fnames[0].substr(0,job.fnames[0].rfind('/'));
+
+  /// Find pdf pages and their cache entries, load other pages ///
+  regex reImage( "^(.+\\.pdf)(\\[[0-9]+\\])?$", regex_constants::icase );
+  map<string,string> pdfhashes;
+  vector<RasterItem> items;
+  smatch match;
+  for( int n=0; n<(int)needed.size(); n++ ) {
+    if( ! needed[n] )
+      continue;
+    string source = page.getPageImageFilename(n);
+    if( gb_rastercache == NULL || ! regex_match( source, match, reImage ) ) {
+      page.loadImage( n, NULL, true, gb_density );
+      continue;
+    }
+    string pdf = match[1].str();
+    if( pdf[0] != '/' ) {
+      pdf = xmldir+'/'+pdf;
+      source = xmldir+'/'+source;
+    }
 
-        PageImage featimage = prepimage;
+    RasterItem item = { n, source, "", false, "" };
+    if( pdfhashes.find(pdf) == pdfhashes.end() ) {
+      FeatCache::Hash hash;
+      pdfhashes[pdf] = hashFile( hash, pdf ) ? hash.hex() : "" ;
+    }
+    if( pdfhashes[pdf].empty() ) {
+      page.loadImage( n, NULL, true, gb_density );
+      continue;
+    }
+    FeatCache::Hash hash;
+    hash.update( pdfhashes[pdf] );
+    hash.update( match[2].str() );
+    hash.update( (double)gb_density );
+    string key = hash.hex();
+    string subdir = string(gb_rastercache)+'/'+key.substr(0,2);
+    mkdir( subdir.c_str(), 0755 );
+    item.fname = subdir+'/'+key+".png";
+    item.cached = file_exists( item.fname.c_str() );
+    trace_end( item.cached ? "raster_cache_hit" : "raster_cache_miss", trace_start(), pageid, source.c_str() );
+    items.push_back(item);
+  }
 
-        /// Redo preprocessing for random perturbation ///
-        if( randpert ) {
-          featimage = gb_images[image_num].image;
-          gb_extractor->preprocess( featimage, NULL, randpert );
-        }
+  /// Rasterize pdf pages in parallel ///
+  if( items.size() > 0 ) {
+    RasterWork work;
+    work.items = &items;
+    work.pageid = pageid;
+    work.next = 0;
+    pthread_mutex_init( &work.mutex, NULL );
+    int T = gb_numrasterizers < (int)items.size() ? gb_numrasterizers : items.size() ;
+    vector<pthread_t> threads( T > 1 ? T-1 : 0 );
+    int created = 0;
+    while( created < (int)threads.size() && pthread_create( &threads[created], NULL, rasterThread, &work ) == 0 )
+      created++;
+    rasterThread( &work );
+    for( int t=0; t<created; t++ )
+      pthread_join( threads[t], NULL );
+    pthread_mutex_destroy( &work.mutex );
+  }
 
-        /// Extract features ///
-        logger( 5, "extraction: %s (thread %d)", imgname.c_str(), thread );
-        cv::Mat feats = gb_extractor->extractFeats( featimage, slope, slant, xheight, gb_savexml ? &fpgram : NULL, randpert, gb_images[image_num].rotation, gb_images[image_num].direction );
+  /// Load the rasterized pages, directly from the pdf if rasterization failed ///
+  for( int k=0; k<(int)items.size(); k++ ) {
+    RasterItem& item = items[k];
+    if( ! item.error.empty() ) {
+      logger( 1, "warning: rasterization failed, loading directly: %s: %s", item.source.c_str(), item.error.c_str() );
+      page.loadImage( item.pagenum, NULL, true, gb_density );
+    }
+    else
+      page.loadImage( item.pagenum, item.fname.c_str(), true );
+  }
+  logger( 2, "loaded %d page images, %d pdf pages through the raster cache", (int)count( needed.begin(), needed.end(), true ), (int)items.size() );
+}
 
-        /// Check whether to skip wide feats ///
-        if ( gb_skipwide && feats.cols > gb_skipwide ) {
-          skipsample = true;
-          break;
-        }
+/**
+ * Loads a job: reads and crops a Page XML or names a group of line images.
+ */
+void loadJob( InputJob& job ) {
+  chrono::high_resolution_clock::time_point tm = chrono::high_resolution_clock::now();
+
+  /// Read Page XML file ///
+  if( job.isxml ) {
+    const char *fname = job.fnames[0].c_str();
+    logger( 1, "processing file %d: %s", job.num, fname );
+
+    int64_t trace_tm = trace_start();
+    job.page = new PageXML;
+    PageXML& page = *job.page;
+    if( job.fnames[0] == "-" ) {
+      string xml;
+      char buf[65536];
+      size_t len;
+      while( ( len = fread( buf, 1, sizeof(buf), stdin ) ) > 0 )
+        xml.append( buf, len );
+      page.loadXmlString( xml.c_str() );
+    }
+    else
+      page.loadXml( fname );
+    if( gb_regproc )
+      page.processStart(tool);
+    page.simplifyIDs();
+
+    /// Restrict to a contiguous range of lines if sharding by lines ///
+    job.xpath = gb_xpath;
+    if( gb_shardlines ) {
+      long num = page.count(gb_xpath);
+      long first = gb_shard*num/gb_numshards;
+      long last = (gb_shard+1)*num/gb_numshards;
+      job.xpath = string("(")+gb_xpath+")[position() > "+to_string(first)+" and position() <= "+to_string(last)+"]";
+      logger( 2, "shard %d/%d: lines %ld to %ld of %ld", gb_shard, gb_numshards, first+1, last, num );
+    }
 
-        /// Write features to file ///
-        char *feaext = gb_extractor->isImageFormat() ? gb_imgext : gb_feaext ;
-        if( ! gb_overwrite && file_exists((outname+"."+feaext).c_str()) ) {
-          logger( 0, "error: aborted write to existing file: %s", (outname+"."+feaext).c_str() );
-          gb_failure = true;
-        }
-        if ( ! gb_join_nth )
-          gb_extractor->write( feats, (outname+"."+feaext).c_str() );
-        else {
-          if ( join_feats.cols == 0 )
-            join_feats = feats;
-          else {
-            if ( join_feats.rows != feats.rows ) {
-              logger( 0, "error: not possible to join if there is no height normalization" );
-              exit(1);
-            }
-            cv::hconcat(join_feats,feats,join_feats);
-          }
-          if ( gb_join_write[image_num] ) {
-            gb_extractor->write( join_feats, (outname+"."+feaext).c_str() );
-            join_feats = cv::Mat();
-          }
-        }
+    /// Load at the given density only the pages with selected lines ///
+    if( gb_density )
+      loadPageImages( job, page );
+    for( int n=0; n<page.numPages(); n++ )
+      job.pagebytes += image_bytes( page.getPageImage(n) );
+    hold_bytes( job.pagebytes );
+    trace_end( "read_xml", trace_tm, fname );
+    trace_tm = trace_start();
+
+    if( ! gb_lazycrop ) {
+      job.images = page.crop( job.xpath.c_str(), NULL, true, NULL, gb_basexpath );
+      for( int k=0; k<(int)job.images.size(); k++ )
+        hold_bytes( image_bytes( job.images[k].image ) );
+      logger( 2, "page read and line cropping time: %.0f ms", time_diff(tm) );
+      logger( 3, "memory (RSS) after cropping %d lines: %.1f MB", (int)job.images.size(), current_rss() );
+    }
 
-        /// Write features image to file ///
-        if( gb_savefeaimg && ! gb_extractor->isImageFormat() ) {
-          if( ! gb_overwrite && file_exists((outname+"_fea."+gb_imgext).c_str()) ) {
-            logger( 0, "error: aborted write to existing file: %s", (outname+"_fea."+gb_imgext).c_str() );
-            gb_failure = true;
-          }
-#if defined (__PAGEXML_IMG_MAGICK__)
-          featimage.write( (outname+"_fea."+gb_imgext).c_str() );
-#elif defined (__PAGEXML_IMG_CV__)
-          imwrite( (outname+"_fea."+gb_imgext).c_str(), featimage );
-#endif
-        }
+    /// Or only select lines, these are cropped by the extraction threads ///
+    else {
+      job.lazy = true;
+      vector<xmlNodePt> sel = page.select(job.xpath.c_str());
+      job.images.resize(sel.size());
+      for( int k=0; k<(int)sel.size(); k++ ) {
+        job.images[k].node = sel[k];
+        job.images[k].id = page.getAttr( sel[k]->parent, "id" );
+        job.images[k].name = job.images[k].id; // Replaced by the name given by PageXML::crop
+      }
+      logger( 2, "page read and line selection time: %.0f ms", time_diff(tm) );
+    }
+    trace_end( "crop", trace_tm, fname );
+
+    if ( gb_join ) {
+      job.join_nth = true;
+      vector<xmlNodePt> sel = page.select(job.xpath.c_str());
+      int num = sel.size();
+      job.join_write.resize(num);
+      job.join_group.resize(num);
+      job.joinfeats.resize(num);
+      for ( int k=0; k<num; k++ ) {
+        if ( k == 0 || sel[k]->parent->parent != sel[k-1]->parent->parent )
+          job.join_pending.push_back(0);
+        job.join_group[k] = job.join_pending.size()-1;
+        job.join_pending.back()++;
+        job.join_write[k] = k == num-1 || sel[k]->parent->parent != sel[k+1]->parent->parent;
       }
+      job.join_written.assign( job.join_pending.size(), false );
+    }
+  }
 
-      logger( 3, "feature extraction time: %.0f ms", time_diff(tm) );
+  /// Or name a set of input images, these are read by the extraction threads ///
+  else {
+    smatch base_match;
 
-      /// Save extraction information ///
-      pthread_mutex_lock( &gb_mutex );
-      if ( skipsample )
-        gb_featskip.push_back(image_num);
-      else {
-        FeatInfo featinfo = { image_num, slope, slant, fcontour, fpgram };
-        gb_featinfo.push_back(featinfo);
-      }
-      pthread_mutex_unlock( &gb_mutex );
+    for( int m=0; m<(int)job.fnames.size(); m++ ) {
+      string& argvn = job.fnames[m];
+      string linename =
+        ( regex_match(argvn,base_match,gb_reBase1) || regex_match(argvn,base_match,gb_reBase2) ) ?
+        base_match[1].str() :
+        argvn ;
 
-    } catch( const std::exception& e ) {
-      pthread_mutex_lock( &gb_mutex );
-      gb_featfail.push_back(image_num);
+      NamedImage namedline;
+      namedline.id = namedline.name = linename;
+      job.images.push_back(namedline);
+    }
+  }
+}
+
+/**
+ * Function for loading jobs ahead of the extraction with pthread.
+ */
+void* readerThread( void* ) {
+  if( gb_tracer != NULL )
+    gb_tracer->threadName( "reader" );
+
+  while( true ) {
+
+    /// Thread safe selection of job to load, limited by the lookahead ///
+    pthread_mutex_lock( &gb_jobmutex );
+    while( ( gb_next_job >= gb_jobbase+(int)gb_jobs.size() && ! gb_endinput ) ||
+           ( gb_next_job < gb_jobbase+(int)gb_jobs.size() && gb_next_job > gb_jobbase+gb_lookahead ) ||
+           ( gb_next_job < gb_jobbase+(int)gb_jobs.size() && gb_next_job > gb_jobbase &&
+             over_budget() ) )
+      pthread_cond_wait( &gb_jobcond, &gb_jobmutex );
+    if( gb_next_job >= gb_jobbase+(int)gb_jobs.size() ) {
+      pthread_mutex_unlock( &gb_jobmutex );
+      break;
+    }
+    InputJob& job = *gb_jobs[gb_next_job-gb_jobbase];
+    gb_next_job++;
+    pthread_mutex_unlock( &gb_jobmutex );
+
+    try {
+      loadJob( job );
+    } catch( const std::exception& e ) {
+      logger( 0, "error: failed to load: %s", job.fnames[0].c_str() );
+      logger( 0, "%s", e.what() );
+      for( int k=0; k<(int)job.images.size(); k++ )
+        hold_bytes( -image_bytes( job.images[k].image ) );
+      job.images.clear();
+      job.failed = true;
+    }
+
+    pthread_mutex_lock( &gb_jobmutex );
+    job.loaded = true;
+    pthread_cond_broadcast( &gb_jobcond );
+    pthread_mutex_unlock( &gb_jobmutex );
+  }
+
+  pthread_exit((void*)0);
+}
+
+/**
+ * Adds all lines of a loaded job to the queue of the extraction threads.
+ */
+void queueJob( InputJob& job ) {
+  int num = job.images.size();
+  job.featinfo.resize(num);
+  job.featstat.assign(num,FEAT_PENDING);
+  job.reppending.assign(num,0);
+  job.pending = num;
+  if( gb_ark != NULL && gb_arkorder )
+    job.arkrecs.assign( num, vector<string>( gb_numrand > 1 ? gb_numrand : 1 ) );
+
+  /// Open features archive of the job ///
+  job.archive = gb_runarchive;
+  if( gb_archive && gb_runarchive == NULL && num > 0 ) {
+    string base = job.isxml ?
+      ( job.fnames[0] == "-" ? string("stdin") : regex_replace(job.fnames[0],regex("^(.*/)?([^/]+)\\.[^./]+$"),"$2") ) :
+      job.images[0].name ;
+    string fname = job.req->outdir+'/'+base+'.'+gb_default_archext;
+    job.archive = new FeatArchive;
+    try {
+      job.archive->open( fname.c_str(), ! gb_overwrite );
+      job.archive->setEncoding( gb_quant );
+    }
+    catch( const std::exception& e ) {
+      logger( 0, "error: %s", e.what() );
+      delete job.archive;
+      job.archive = NULL;
+      job.featstat.assign(num,FEAT_FAILED);
+      job.failure = true;
+      num = 0;
+    }
+  }
+
+  if( num == 0 ) {
+    pthread_mutex_lock( &gb_jobmutex );
+    job.finished = true;
+    pthread_mutex_unlock( &gb_jobmutex );
+    return;
+  }
+
+  pthread_mutex_lock( &gb_mutex );
+  for( int k=0; k<num; k++ ) {
+    WorkItem item = { &job, k, -1 };
+    gb_workqueue.push_back(item);
+  }
+  pthread_cond_broadcast( &gb_workcond );
+  pthread_mutex_unlock( &gb_mutex );
+}
+
+/**
+ * Marks a request of a client as replied, or the end of its input, and closes
+ * the client if nothing more is pending. The check is done in the same locked
+ * section as the change, so that only one caller closes the client.
+ *
+ * @param eof   Whether the end of the input is reached instead of a reply.
+ */
+void releaseClient( Client *client, bool eof ) {
+  pthread_mutex_lock( &gb_jobmutex );
+  if( eof ) {
+    client->eof = true;
+    if( client->in == stdin ) {
+      gb_endinput = true;
+      pthread_cond_broadcast( &gb_jobcond );
+    }
+  }
+  else
+    client->pending--;
+  bool release = client->eof && client->pending == 0;
+  pthread_mutex_unlock( &gb_jobmutex );
+  if( ! release )
+    return;
+
+  if( client->in != stdin ) {
+    fclose( client->in );
+    fclose( client->out );
+  }
+  pthread_mutex_destroy( &client->mutex );
+  delete client;
+}
+
+/**
+ * Finalizes a finished job: counts results and prints the features list.
+ */
+void finalizeJob( InputJob& job, char *feaext ) {
+  Request& req = *job.req;
+  FILE *out = req.client != NULL ? req.client->out : stdout;
+
+  /// Write Kaldi ark records in input order ///
+  for( int k=0; k<(int)job.arkrecs.size(); k++ )
+    for( int r=0; r<(int)job.arkrecs[k].size(); r++ )
+      try {
+        if( ! job.arkrecs[k][r].empty() )
+          gb_ark->write( job.arkrecs[k][r] );
+      }
+      catch( const std::exception& e ) {
+        logger( 0, "error: %s", e.what() );
+        job.failure = true;
+      }
+
+  if( job.failed || job.failure )
+    req.failure = true;
+
+  int numextract = 0;
+  int numskipped = 0;
+  int numfailed = 0;
+  for( int k=0; k<(int)job.featstat.size(); k++ )
+    switch( job.featstat[k] ) {
+      case FEAT_EXTRACTED: numextract++; break;
+      case FEAT_SKIPPED:   numskipped++; break;
+      case FEAT_FAILED:    numfailed++;  break;
+    }
+  req.numextract += numextract;
+  req.numskipped += numskipped;
+  req.numfailed += numfailed;
+  pthread_mutex_lock( &gb_jobmutex );
+  gb_numextract += numextract;
+  gb_numskipped += numskipped;
+  gb_numfailed += numfailed;
+  if( job.isxml && ! job.failed )
+    gb_numpages++;
+  pthread_mutex_unlock( &gb_jobmutex );
+  if( job.images.size() > 0 && numextract == 0 )
+    req.failure = true;
+
+  if( req.client != NULL )
+    pthread_mutex_lock( &req.client->mutex );
+
+  /// Extracted features list ///
+  if( ( gb_baselist || gb_featlist ) && ! req.failure )
+    for( int k=0; k<(int)job.featstat.size(); k++ ) {
+      string name;
+      if ( ! job.join_nth && job.featstat[k] == FEAT_EXTRACTED )
+        name = gb_onlyid ? job.images[k].id : job.images[k].name;
+      else if ( job.join_nth && job.join_write[k] && job.join_written[job.join_group[k]] )
+        name = job.page->getNodeName( job.images[k].node->parent->parent );
+      if ( name.empty() )
+        continue;
+      vector<string> keys;
+      if( gb_numrand < 2 )
+        keys.push_back( name );
+      else
+        for( int r=0; r<gb_numrand; r++ )
+          keys.push_back( to_string(r)+'/'+name );
+      for( int r=0; r<(int)keys.size(); r++ )
+        if( gb_baselist )
+          fprintf( out, "%s\n", keys[r].c_str() );
+        else if( job.archive != NULL )
+          fprintf( out, "%s:%s\n", job.archive->getFilename().c_str(), keys[r].c_str() );
+        else if( gb_ark != NULL )
+          fprintf( out, "%s:%s\n", gb_arkfile, keys[r].c_str() );
+        else
+          fprintf( out, "%s/%s.%s\n", req.outdir.c_str(), keys[r].c_str(), feaext );
+    }
+
+  if( req.savexml && ! job.isxml )
+    logger( 0, "warning: requested to save xml but input is not xml" );
+
+  if( req.client == NULL )
+    return;
+
+  /// Reply status after the last job of a server request ///
+  Client *client = req.client;
+  if( --req.numjobs > 0 ) {
+    pthread_mutex_unlock( &client->mutex );
+    return;
+  }
+  fprintf( out, "# %s extracted=%d skipped=%d failed=%d\n", req.failure ? "failed" : "ok", req.numextract, req.numskipped, req.numfailed );
+  fflush( out );
+  pthread_mutex_unlock( &client->mutex );
+  delete job.req;
+  job.req = NULL;
+  releaseClient( client, false );
+}
+
+/**
+ * Parses a server request line into output options and input files.
+ */
+bool parseRequest( char *line, Request& req, vector<string>& files, string& err ) {
+  for( char *tok = strtok(line," \t\r\n"); tok != NULL; tok = strtok(NULL," \t\r\n") ) {
+    if( ! strncmp(tok,"--outdir=",9) )
+      req.outdir = tok+9;
+    else if( ! strcmp(tok,"--savexml") )
+      req.savexml = true;
+    else if( ! strncmp(tok,"--savexml=",10) ) {
+      req.savexml = true;
+      req.savexmldir = tok+10;
+    }
+    else if( ! strncmp(tok,"--",2) ) {
+      err = string("unknown request option: ")+tok;
+      return false;
+    }
+    else if( ! strcmp(tok,"-") ) {
+      err = "stdin input not possible in server mode";
+      return false;
+    }
+    else
+      files.push_back(tok);
+  }
+
+  if( files.size() == 0 ) {
+    err = "expected at least one Page XML or line image file";
+    return false;
+  }
+  if( ! file_exists(req.outdir.c_str()) ) {
+    err = "output directory does not exist: "+req.outdir;
+    return false;
+  }
+  if( gb_numrand > 1 )
+    for( int n=0; n<gb_numrand; n++ )
+      mkdir( (req.outdir+'/'+to_string(n)).c_str(), 0755 );
+
+  return true;
+}
+
+/**
+ * Function for reading the requests of a client with pthread.
+ */
+void* clientThread( void* _client ) {
+  Client *client = (Client*)_client;
+
+  char *line = NULL;
+  size_t size = 0;
+  while( getline( &line, &size, client->in ) != -1 ) {
+    if( line[strspn(line," \t\r\n")] == '\0' )
+      continue;
+
+    Request *req = new Request();
+    req->client = client;
+    req->outdir = gb_outdir;
+    req->savexml = gb_savexml;
+    req->savexmldir = gb_savexmldir != NULL ? gb_savexmldir : "";
+
+    vector<string> files;
+    string err;
+    if( ! parseRequest( line, *req, files, err ) ) {
+      pthread_mutex_lock( &client->mutex );
+      fprintf( client->out, "# error %s\n", err.c_str() );
+      fflush( client->out );
+      pthread_mutex_unlock( &client->mutex );
+      delete req;
+      continue;
+    }
+
+    pthread_mutex_lock( &gb_jobmutex );
+    client->pending++;
+    pthread_mutex_unlock( &gb_jobmutex );
+    addJobs( *req, files );
+  }
+  free( line );
+
+  releaseClient( client, true );
+
+  pthread_exit((void*)0);
+}
+
+/**
+ * Function for accepting clients on the UNIX socket with pthread.
+ */
+void* serverThread( void* ) {
+  while( true ) {
+    int fd = accept( gb_sockfd, NULL, NULL );
+    if( fd < 0 ) {
+      if( errno == EINTR )
+        continue;
+      logger( 0, "error: failed to accept connection: %s", strerror(errno) );
+      break;
+    }
+
+    Client *client = new Client();
+    client->in = fdopen( fd, "r" );
+    client->out = fdopen( dup(fd), "w" );
+    pthread_mutex_init( &client->mutex, NULL );
+    pthread_t thread;
+    pthread_create( &thread, NULL, clientThread, (void*)client );
+    pthread_detach( thread );
+  }
+
+  pthread_exit((void*)0);
+}
+
+/**
+ * Saves the Page XML of a finished job with the feature extraction information.
+ */
+void saveJobXml( InputJob& job ) {
+  PageXML *page = job.page;
+  Request& req = *job.req;
+  string outfile = job.fnames[0];
+  if( gb_xmlbasepath )
+    outfile = page->getValue(page->selectNth(gb_basexpath))+".xml";
+  else if( outfile == "-" )
+    outfile = regex_replace(page->getAttr(page->selectNth("//_:Page"),"imageFilename"),regex("\\.[^./]+$"),"")+".xml";
+  outfile = (req.savexmldir!=""?req.savexmldir:req.outdir)+'/'+regex_replace(outfile,regex(".*/"),"");
+  if( ! gb_overwrite && file_exists(outfile.c_str()) ) {
+    logger( 0, "error: aborted write to existing file: %s", outfile.c_str() );
+    job.failure = true;
+    return;
+  }
+
+  for( int k=0; k<(int)job.featstat.size(); k++ ) {
+    xmlNodePtr elem = job.images[k].node->parent;
+    if( job.featstat[k] == FEAT_FAILED )
+      page->setProperty( elem, "textFeats-failed" );
+    else if( job.featstat[k] == FEAT_SKIPPED )
+      page->setProperty( elem, "textFeats-skipped" );
+  }
+  for( int k=0; k<(int)job.featstat.size(); k++ ) {
+    if( job.featstat[k] != FEAT_EXTRACTED )
+      continue;
+    FeatInfo& featinfo = job.featinfo[k];
+    xmlNodePtr elem = job.images[k].node->parent;
+    page->setProperty( elem, "rotation", job.images[k].rotation );
+    page->setProperty( elem, "slope", featinfo.slope );
+    page->setProperty( elem, "slant", featinfo.slant );
+    if( featinfo.fcontour.size() > 0 ) {
+      if( gb_fpoints )
+        page->setCoords( elem, featinfo.fcontour );
+      else
+        page->setProperty( elem, "fcontour", page->pointsToString(featinfo.fcontour).c_str() );
+    }
+    if( featinfo.fpgram.size() > 0 )
+      page->setProperty( elem, "fpgram", page->pointsToString(featinfo.fpgram).c_str() );
+  }
+  if( gb_regproc )
+    page->processEnd();
+  page->write( outfile.c_str() );
+}
+
+/**
+ * Marks a line of a job as processed, finishing the job if it was the last one.
+ */
+void finishLine( InputJob& job ) {
+  pthread_mutex_lock( &gb_jobmutex );
+  bool last = --job.pending == 0;
+  pthread_mutex_unlock( &gb_jobmutex );
+  if( ! last )
+    return;
+
+  for( int k=0; k<(int)job.failedwrites.size(); k++ )
+    job.featstat[job.failedwrites[k]] = FEAT_FAILED;
+
+  if( job.isxml && job.req->savexml )
+    saveJobXml( job );
+
+  if( job.archive != NULL && job.archive != gb_runarchive ) {
+    try {
+      job.archive->close();
+    }
+    catch( const std::exception& e ) {
+      logger( 0, "error: %s", e.what() );
+      job.failure = true;
+    }
+  }
+
+  pthread_mutex_lock( &gb_jobmutex );
+  job.finished = true;
+  pthread_cond_broadcast( &gb_jobcond );
+  pthread_mutex_unlock( &gb_jobmutex );
+}
+
+/**
+ * Writes features or an image to a file, checking whether it would be overwritten.
+ */
+void writeFile( WriteItem& item ) {
+  chrono::high_resolution_clock::time_point tm = chrono::high_resolution_clock::now();
+  int64_t trace_tm = trace_start();
+
+  if( ! gb_overwrite && file_exists(item.fname.c_str()) ) {
+    logger( 0, "error: aborted write to existing file: %s", item.fname.c_str() );
+    item.job->failure = true;
+    return;
+  }
+  if( ! item.isimage )
+    gb_extractor->write( item.feats, item.fname.c_str() );
+  else {
+#if defined (__PAGEXML_IMG_MAGICK__)
+    item.image.write( item.fname.c_str() );
+#elif defined (__PAGEXML_IMG_CV__)
+    imwrite( item.fname.c_str(), item.image );
+#endif
+  }
+
+  trace_end( "write_file", trace_tm, NULL, item.fname.c_str() );
+  float elapsed = time_diff(tm);
+  struct stat st;
+  off_t bytes = gb_metricsfile != NULL && ! stat( item.fname.c_str(), &st ) ? st.st_size : 0;
+  pthread_mutex_lock( &gb_writemutex );
+  gb_writetime += elapsed;
+  gb_writebytes += bytes;
+  pthread_mutex_unlock( &gb_writemutex );
+}
+
+/**
+ * Writes features or an image to a file, directly if there are no writer
+ * threads, otherwise queued, waiting while the queue is full.
+ */
+void outputFile( InputJob& job, int line, const string& fname, const cv::Mat* feats, const PageImage* image ) {
+  WriteItem item;
+  item.job = &job;
+  item.line = line;
+  item.fname = fname;
+  item.isimage = image != NULL;
+  if( feats != NULL )
+    item.feats = *feats;
+  if( image != NULL ) {
+#if defined (__PAGEXML_IMG_MAGICK__)
+    item.image = *image;
+#elif defined (__PAGEXML_IMG_CV__)
+    item.image = image->clone();
+#endif
+  }
+
+  if( gb_numwriters == 0 ) {
+    writeFile( item );
+    return;
+  }
+
+  /// The write counts as pending work of the job until done ///
+  pthread_mutex_lock( &gb_jobmutex );
+  job.pending++;
+  pthread_mutex_unlock( &gb_jobmutex );
+
+  chrono::high_resolution_clock::time_point tm = chrono::high_resolution_clock::now();
+  int64_t trace_tm = trace_start();
+  pthread_mutex_lock( &gb_writemutex );
+  while( (int)gb_writequeue.size() >= gb_writequeue_max )
+    pthread_cond_wait( &gb_writespacecond, &gb_writemutex );
+  gb_writewait += time_diff(tm);
+  trace_end( "wait_writequeue", trace_tm );
+  gb_writequeue.push_back(item);
+  pthread_cond_signal( &gb_writecond );
+  pthread_mutex_unlock( &gb_writemutex );
+}
+
+/**
+ * Function for writing queued files with pthread.
+ */
+void* writerThread( void* ) {
+  const int batch_size = 16;
+  if( gb_tracer != NULL )
+    gb_tracer->threadName( "writer" );
+
+  while( true ) {
+
+    /// Thread safe selection of up to batch_size queued files, to take the lock less often ///
+    pthread_mutex_lock( &gb_writemutex );
+    while( gb_writequeue.empty() && ! gb_nomorewrites )
+      pthread_cond_wait( &gb_writecond, &gb_writemutex );
+    if( gb_writequeue.empty() ) {
+      pthread_mutex_unlock( &gb_writemutex );
+      break;
+    }
+    vector<WriteItem> batch;
+    while( ! gb_writequeue.empty() && (int)batch.size() < batch_size ) {
+      batch.push_back( gb_writequeue.front() );
+      gb_writequeue.pop_front();
+    }
+    pthread_cond_broadcast( &gb_writespacecond );
+    pthread_mutex_unlock( &gb_writemutex );
+
+    /// Write the files one by one ///
+    for( int n=0; n<(int)batch.size(); n++ ) {
+      InputJob& job = *batch[n].job;
+      try {
+        writeFile( batch[n] );
+      }
+      catch( const std::exception& e ) {
+        logger( 0, "warning: failed write: %s", batch[n].fname.c_str() );
+        logger( 0, "%s", e.what() );
+        pthread_mutex_lock( &gb_jobmutex );
+        job.failedwrites.push_back( batch[n].line );
+        pthread_mutex_unlock( &gb_jobmutex );
+      }
+      batch[n] = WriteItem();
+      finishLine( job );
+    }
+  }
+
+  pthread_exit((void*)0);
+}
+
+/**
+ * Writes a features matrix to the Kaldi ark, the archive of the job or to its own file.
+ * For ordered ark output the record is kept in the slot of the line and replica.
+ */
+void writeFeats( InputJob& job, int line, int r, const cv::Mat& feats, const string& key, const string& fname ) {
+  int64_t trace_tm = trace_start();
+  if( gb_ark != NULL ) {
+    if( gb_arkorder )
+      job.arkrecs[line][r] = ArkWriter::record( key, feats, gb_quant );
+    else
+      gb_ark->write( key, feats );
+  }
+  else if( job.archive != NULL )
+    job.archive->write( key, feats );
+  else {
+    outputFile( job, line, fname, &feats, NULL );
+    trace_end( "write", trace_tm, job.isxml ? job.fnames[0].c_str() : NULL, key.c_str() );
+    return;
+  }
+  pthread_mutex_lock( &gb_writemutex );
+  gb_writebytes += feats.total()*feats.elemSize();
+  pthread_mutex_unlock( &gb_writemutex );
+  trace_end( "write", trace_tm, job.isxml ? job.fnames[0].c_str() : NULL, key.c_str() );
+}
+
+/**
+ * Marks a line of a join group as processed. For the last line of the group to
+ * be processed, concatenates the features of the extracted lines of the group
+ * in document order into a preallocated matrix and writes it.
+ */
+void joinLine( InputJob& job, int line ) {
+  if ( job.featstat[line] != FEAT_EXTRACTED )
+    job.joinfeats[line].clear();
+
+  int group = job.join_group[line];
+  pthread_mutex_lock( &gb_jobmutex );
+  bool last = --job.join_pending[group] == 0;
+  pthread_mutex_unlock( &gb_jobmutex );
+  if ( ! last )
+    return;
+
+  int64_t trace_tm = trace_start();
+  int first = line;
+  while ( first > 0 && job.join_group[first-1] == group )
+    first--;
+  int end = line+1;
+  while ( end < (int)job.join_group.size() && job.join_group[end] == group )
+    end++;
+
+  string name = job.page->getNodeName( job.images[end-1].node->parent->parent );
+  char *feaext = gb_extractor->isImageFormat() ? gb_imgext : gb_feaext ;
+  int R = gb_numrand == 0 ? 1 : gb_numrand ;
+  bool written = false;
+  for ( int r=0; r<R; r++ ) {
+    int rows = -1;
+    int cols = 0;
+    int type = 0;
+    bool mismatch = false;
+    for ( int k=first; k<end; k++ ) {
+      if ( job.joinfeats[k].size() <= (size_t)r || job.joinfeats[k][r].empty() )
+        continue;
+      cv::Mat& feats = job.joinfeats[k][r];
+      if ( rows < 0 ) {
+        rows = feats.rows;
+        type = feats.type();
+      }
+      else if ( feats.rows != rows || feats.type() != type )
+        mismatch = true;
+      cols += feats.cols;
+    }
+    if ( rows < 0 )
+      break;
+    if ( mismatch ) {
+      logger( 0, "error: not possible to join if there is no height normalization: %s", name.c_str() );
+      job.failure = true;
+      break;
+    }
+
+    cv::Mat join_feats( rows, cols, type );
+    for ( int k=first, col=0; k<end; k++ ) {
+      if ( job.joinfeats[k].size() <= (size_t)r || job.joinfeats[k][r].empty() )
+        continue;
+      cv::Mat& feats = job.joinfeats[k][r];
+      cv::Mat dest = join_feats.colRange(col,col+feats.cols);
+      feats.copyTo( dest );
+      col += feats.cols;
+    }
+
+    string outkey = (gb_numrand>1?to_string(r)+"/":"")+name;
+    try {
+      writeFeats( job, end-1, r, join_feats, outkey, job.req->outdir+"/"+outkey+"."+feaext );
+      written = true;
+    } catch( const std::exception& e ) {
+      logger( 0, "warning: failed write of joined features: %s", outkey.c_str() );
+      logger( 0, "%s", e.what() );
+      job.failure = true;
+    }
+  }
+
+  for ( int k=first; k<end; k++ )
+    job.joinfeats[k].clear();
+  job.join_written[group] = written;
+  trace_end( "join", trace_tm, job.fnames[0].c_str(), name.c_str() );
+}
+
+/**
+ * Adds the pixels of an image to a hash, with its size, depth and type.
+ */
+void hashImage( FeatCache::Hash& hash, PageImage& image ) {
+#if defined (__PAGEXML_IMG_MAGICK__)
+  int cols = image.columns();
+  int rows = image.rows();
+  int depth = image.depth();
+  hash.update( (double)depth );
+  hash.update( (double)image.type() );
+  /// Pixels at 16 bits for images deeper than 8 ///
+  int bytes = depth > 8 ? 2 : 1 ;
+  vector<unsigned char> row( 4*bytes*cols );
+  for( int y=0; y<rows; y++ ) {
+    image.write( 0, y, cols, 1, "RGBA", bytes == 2 ? Magick::ShortPixel : Magick::CharPixel, row.data() );
+    hash.update( row.data(), row.size() );
+  }
+#elif defined (__PAGEXML_IMG_CV__)
+  int cols = image.cols;
+  int rows = image.rows;
+  hash.update( (double)image.type() );
+  for( int y=0; y<rows; y++ )
+    hash.update( image.ptr<unsigned char>(y), cols*image.elemSize() );
+#endif
+  hash.update( (double)cols );
+  hash.update( (double)rows );
+}
+
+/**
+ * Returns the seed for the random perturbations of a replica of a line, derived
+ * from the run seed, the line id qualified by its image and the replica index.
+ */
+inline uint64_t replica_seed( const string& name, int r ) {
+  string key = to_string(gb_seed)+'\n'+name+'\n'+to_string(r);
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for( size_t n=0; n<key.size(); n++ ) {
+    hash ^= (unsigned char)key[n];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash != 0 ? hash : 1;
+}
+
+/**
+ * Extracts the features of a replica of a line. For perturbed replicas the line
+ * image is preprocessed again. The perturbations of TextFeatExtractor are drawn
+ * from cv::theRNG(), which is per thread, so it is seeded here for the replica
+ * and the result does not depend on the thread nor on the output naming. The
+ * rand_threads test checks that -T1 and -T4 give identical output.
+ *
+ * @param featimage  Preprocessed image, replaced by the perturbed one if randomized.
+ * @return           The features matrix.
+ */
+cv::Mat extractReplica( InputJob& job, int line, int r, PageImage& featimage, float slope, float slant, int xheight, vector<cv::Point2f>* fpgram ) {
+  NamedImage& namedimg = job.images[line];
+  string imgname = gb_onlyid ? namedimg.id : namedimg.name;
+  const char *pageid = job.isxml ? job.fnames[0].c_str() : NULL;
+  bool randpert = r > 0 || ( r == 0 && gb_firstrand ) ;
+
+  /// Redo preprocessing for random perturbation ///
+  if( randpert ) {
+    // Assumes that preprocess and extractFeats draw all their randomness from
+    // cv::theRNG() of this thread; any other source (rand(), a member or static
+    // generator) would make the replicas depend on the thread schedule again
+    cv::theRNG().state = replica_seed( namedimg.name, r );
+    featimage = namedimg.image;
+    int64_t trace_tm = trace_start();
+    gb_extractor->preprocess( featimage, NULL, randpert );
+    trace_end( "preprocess_rand", trace_tm, pageid, imgname.c_str() );
+  }
+
+  /// Extract features ///
+  logger( 5, "extraction: %s replica %d", imgname.c_str(), r );
+  int64_t trace_tm = trace_start();
+  cv::Mat feats = gb_extractor->extractFeats( featimage, slope, slant, xheight, fpgram, randpert, namedimg.rotation, namedimg.direction );
+  trace_end( "extract", trace_tm, pageid, imgname.c_str() );
+  return feats;
+}
+
+/**
+ * Writes the features of a replica of a line, or keeps them for joining.
+ *
+ * @return   false if the sample is skipped for being too wide, otherwise true.
+ */
+bool outputReplica( InputJob& job, int line, int r, const cv::Mat& feats, PageImage& featimage ) {
+
+  /// Check whether to skip wide feats ///
+  if ( gb_skipwide && feats.cols > gb_skipwide )
+    return false;
+
+  NamedImage& namedimg = job.images[line];
+  string imgname = gb_onlyid ? namedimg.id : namedimg.name;
+  string outkey = (gb_numrand>1?to_string(r)+"/":"")+imgname;
+  string outname = job.req->outdir+"/"+outkey;
+
+  /// Write features to file, archive or ark, or keep them for joining ///
+  char *feaext = gb_extractor->isImageFormat() ? gb_imgext : gb_feaext ;
+  if ( ! job.join_nth )
+    writeFeats( job, line, r, feats, outkey, outname+"."+feaext );
+  else
+    job.joinfeats[line][r] = feats;
+
+  /// Write features image to file ///
+  if( gb_savefeaimg && ! gb_extractor->isImageFormat() )
+    outputFile( job, line, outname+"_fea."+gb_imgext, NULL, &featimage );
+
+  return true;
+}
+
+/**
+ * Finishes a line once it and all its replicas are processed: joins, releases
+ * the line image and marks the line as processed in the job.
+ */
+void releaseLine( InputJob& job, int line ) {
+
+  /// Join features of the group if this was its last line to be processed ///
+  if ( job.join_nth )
+    joinLine( job, line );
+
+  /// Release line image, no longer needed ///
+  hold_bytes( -image_bytes( job.images[line].image ) );
+  job.images[line].image = PageImage();
+  pthread_mutex_lock( &gb_mutex );
+  gb_inflight--;
+  pthread_cond_signal( &gb_memcond );
+  pthread_mutex_unlock( &gb_mutex );
+
+  finishLine( job );
+}
+
+/**
+ * Extracts a perturbation replica of a line that was queued separately.
+ */
+void processReplica( InputJob& job, int line, int r ) {
+  NamedImage& namedimg = job.images[line];
+  string imgname = gb_onlyid ? namedimg.id : namedimg.name;
+
+  try {
+    int xheight = job.isxml ? job.page->getXheight( namedimg.id.c_str() ) : 0;
+    FeatInfo& featinfo = job.featinfo[line];
+    PageImage featimage;
+    cv::Mat feats = extractReplica( job, line, r, featimage, featinfo.slope, featinfo.slant, xheight, NULL );
+    if( ! outputReplica( job, line, r, feats, featimage ) ) {
+      pthread_mutex_lock( &gb_jobmutex );
+      if( job.featstat[line] != FEAT_FAILED )
+        job.featstat[line] = FEAT_SKIPPED;
+      pthread_mutex_unlock( &gb_jobmutex );
+    }
+  } catch( const std::exception& e ) {
+    pthread_mutex_lock( &gb_jobmutex );
+    job.featstat[line] = FEAT_FAILED;
+    pthread_mutex_unlock( &gb_jobmutex );
+    logger( 0, "warning: failed extraction: %s replica %d", imgname.c_str(), r );
+    logger( 0, "%s", e.what() );
+  }
+
+  pthread_mutex_lock( &gb_jobmutex );
+  bool last = --job.reppending[line] == 0;
+  pthread_mutex_unlock( &gb_jobmutex );
+  if( last )
+    releaseLine( job, line );
+}
+
+/**
+ * Function for parallel extraction of features with pthread.
+ */
+void* extractionThread( void* _num ) {
+  int thread = *((int*)_num);
+
+  if( gb_tracer != NULL )
+    gb_tracer->threadName( ("extract "+to_string(thread)).c_str() );
+
+  while( true ) {
+
+    /// Thread safe selection of line to process ///
+    int64_t trace_tm = trace_start();
+    pthread_mutex_lock( &gb_mutex );
+    while( gb_workqueue.empty() && ! gb_nomorework )
+      pthread_cond_wait( &gb_workcond, &gb_mutex );
+    if( gb_workqueue.empty() ) {
+      pthread_mutex_unlock( &gb_mutex );
+      break;
+    }
+    WorkItem item = gb_workqueue.front();
+    gb_workqueue.pop_front();
+    pthread_mutex_unlock( &gb_mutex );
+    trace_end( "wait_work", trace_tm );
+    chrono::high_resolution_clock::time_point busy_tm = chrono::high_resolution_clock::now();
+
+    InputJob& job = *item.job;
+    Request& req = *job.req;
+    int image_num = item.line;
+
+    /// Extract a separately queued perturbation replica ///
+    if( item.rep >= 0 ) {
+      processReplica( job, image_num, item.rep );
+      pthread_mutex_lock( &gb_mutex );
+      gb_busytime[thread] += time_diff(busy_tm);
       pthread_mutex_unlock( &gb_mutex );
+      continue;
+    }
+
+    NamedImage& namedimg = job.images[image_num];
+    const char *pageid = job.isxml ? job.fnames[0].c_str() : NULL;
+
+    /// Wait while over the memory budget, unless no other line is in process ///
+    trace_tm = trace_start();
+    pthread_mutex_lock( &gb_mutex );
+    while( gb_inflight > 0 && over_budget() )
+      pthread_cond_wait( &gb_memcond, &gb_mutex );
+    gb_inflight++;
+    pthread_mutex_unlock( &gb_mutex );
+    if( gb_maxmem > 0 )
+      trace_end( "wait_mem", trace_tm );
+
+    /// Perform extraction ///
+    chrono::high_resolution_clock::time_point tm = chrono::high_resolution_clock::now();
+    string imgname = gb_onlyid ? namedimg.id : namedimg.name;
+    logger( 4, "extracting: %s (thread %d)", imgname.c_str(), thread );
+
+    bool spawned = false;
+    try {
+
+      float slope, slant;
+      vector<cv::Point2f> fpgram;
+      vector<cv::Point> fcontour;
+
+      /// Crop line in lazy crop mode ///
+      if( job.lazy ) {
+        logger( 5, "cropping: %s (thread %d)", imgname.c_str(), thread );
+        trace_tm = trace_start();
+        vector<NamedImage> crop;
+        pthread_mutex_lock( &job.cropmutex );
+        try {
+          xmlChar *path = xmlGetNodePath( namedimg.node );
+          string xpath = path != NULL ? (char*)path : "" ;
+          xmlFree( path );
+          crop = job.page->crop( xpath.c_str(), NULL, true, NULL, gb_basexpath );
+        } catch( ... ) {
+          pthread_mutex_unlock( &job.cropmutex );
+          throw;
+        }
+        pthread_mutex_unlock( &job.cropmutex );
+        if( crop.size() != 1 )
+          throw runtime_error( "unexpected number of lazily cropped lines: "+to_string(crop.size()) );
+        namedimg = crop[0];
+        hold_bytes( image_bytes( namedimg.image ) );
+        imgname = gb_onlyid ? namedimg.id : namedimg.name;
+        trace_end( "crop_line", trace_tm, pageid, imgname.c_str() );
+      }
+
+      /// Read line image in image list mode ///
+      if( ! job.isxml ) {
+        logger( 5, "reading: %s (thread %d)", imgname.c_str(), thread );
+        trace_tm = trace_start();
+#if defined (__PAGEXML_IMG_MAGICK__)
+        namedimg.image.read( job.fnames[image_num] );
+#elif defined (__PAGEXML_IMG_CV__)
+        namedimg.image = cv::imread( job.fnames[image_num] );
+        if( namedimg.image.empty() )
+          throw runtime_error( "unable to read image: "+job.fnames[image_num] );
+#endif
+        hold_bytes( image_bytes( namedimg.image ) );
+        trace_end( "read_image", trace_tm, NULL, imgname.c_str() );
+      }
+
+      /// Get x-height ///
+      int xheight = 0;
+      if( job.isxml )
+        xheight = job.page->getXheight( namedimg.id.c_str() );
+      // @todo x-height estimation from image
+      //xheight = extractor.estimateXheight( prepimage );
+      //logger( 0, "xheight=%d", xheight );
+
+      /// Look up the line in the cache ///
+      string cachekey;
+      cv::Mat cachedfeats;
+      if( gb_cache != NULL ) {
+        trace_tm = trace_start();
+        FeatCache::Hash hash;
+        hash.update( gb_cacheconf );
+        hashImage( hash, namedimg.image );
+        if( job.isxml )
+          hash.update( job.page->getAttr( namedimg.node, "points" ) );
+        hash.update( (double)xheight );
+        hash.update( (double)namedimg.rotation );
+        hash.update( (double)namedimg.direction );
+        hash.update( (double)req.savexml );
+        cachekey = hash.hex();
+        vector<cv::Mat> mats;
+        bool hit = gb_cache->get( cachekey, mats ) && mats.size() == 4;
+        if( hit ) {
+          cachedfeats = mats[0];
+          slope = mats[1].at<float>(0,0);
+          slant = mats[1].at<float>(0,1);
+          fcontour.resize( mats[2].total()*mats[2].channels()/2 );
+          if( fcontour.size() > 0 )
+            memcpy( fcontour.data(), mats[2].data, fcontour.size()*sizeof(cv::Point) );
+          fpgram.resize( mats[3].total()*mats[3].channels()/2 );
+          if( fpgram.size() > 0 )
+            memcpy( fpgram.data(), mats[3].data, fpgram.size()*sizeof(cv::Point2f) );
+        }
+        pthread_mutex_lock( &gb_mutex );
+        if( hit )
+          gb_cachehits++;
+        else
+          gb_cachemisses++;
+        pthread_mutex_unlock( &gb_mutex );
+        trace_end( hit ? "cache_hit" : "cache_miss", trace_tm, pageid, imgname.c_str() );
+      }
+      bool cached = ! cachedfeats.empty();
+
+      PageImage prepimage = namedimg.image;
+
+      if( ! cached ) {
+        /// Clean and enhance image ///
+        logger( 5, "preprocessing: %s (thread %d)", imgname.c_str(), thread );
+        trace_tm = trace_start();
+        gb_extractor->preprocess( prepimage, req.savexml ? &fcontour : NULL );
+        trace_end( "preprocess", trace_tm, pageid, imgname.c_str() );
+        if( gb_saveclean )
+          outputFile( job, image_num, req.outdir+'/'+imgname+"_clean."+gb_imgext, NULL, &prepimage );
+
+        /// Estimate slope and slant (sets them to 0 if disabled) ///
+        logger( 5, "estimating angles: %s (thread %d)", imgname.c_str(), thread );
+        trace_tm = trace_start();
+        gb_extractor->estimateAngles( prepimage, &slope, &slant, namedimg.rotation );
+        trace_end( "estimate_angles", trace_tm, pageid, imgname.c_str() );
+      }
+
+      /// Loop for random perturbation extractions, with several threads only the ///
+      /// first replica is extracted here and the others are queued separately    ///
+      bool skipsample = false;
+      int R = gb_numrand == 0 ? 1 : gb_numrand ;
+      int Rhere = gb_numrand > 1 && gb_numthreads > 1 ? 1 : R ;
+      if ( job.join_nth )
+        job.joinfeats[image_num].assign( R, cv::Mat() );
+      for( int r=0; r<Rhere; r++ ) {
+        PageImage featimage = prepimage;
+
+        /// Extract features, or use the cached ones ///
+        cv::Mat feats = cachedfeats;
+        if( ! cached )
+          feats = extractReplica( job, image_num, r, featimage, slope, slant, xheight, r == 0 && req.savexml ? &fpgram : NULL );
+
+        /// Add features and extraction information to the cache ///
+        if( gb_cache != NULL && ! cached ) {
+          cv::Mat angles( 1, 2, CV_32F );
+          angles.at<float>(0,0) = slope;
+          angles.at<float>(0,1) = slant;
+          vector<cv::Mat> mats;
+          mats.push_back( feats );
+          mats.push_back( angles );
+          mats.push_back( fcontour.empty() ? cv::Mat() : cv::Mat( fcontour.size(), 2, CV_32S, fcontour.data() ) );
+          mats.push_back( fpgram.empty() ? cv::Mat() : cv::Mat( fpgram.size(), 2, CV_32F, fpgram.data() ) );
+          try {
+            gb_cache->put( cachekey, mats );
+          } catch( const std::exception& e ) {
+            logger( 0, "warning: %s", e.what() );
+          }
+        }
+
+        if( ! outputReplica( job, image_num, r, feats, featimage ) ) {
+          skipsample = true;
+          break;
+        }
+      }
+
+      logger( 3, "feature extraction time: %.0f ms", time_diff(tm) );
+
+      /// Save extraction information in the line's own slot ///
+      if ( skipsample )
+        job.featstat[image_num] = FEAT_SKIPPED;
+      else {
+        FeatInfo featinfo = { image_num, slope, slant, fcontour, fpgram };
+        job.featinfo[image_num] = featinfo;
+        job.featstat[image_num] = FEAT_EXTRACTED;
+      }
+
+      /// Queue the remaining replicas first, so that the line is finished soon ///
+      if ( ! skipsample && Rhere < R ) {
+        job.reppending[image_num] = R-Rhere;
+        spawned = true;
+        pthread_mutex_lock( &gb_mutex );
+        for( int r=R-1; r>=Rhere; r-- ) {
+          WorkItem replica = { &job, image_num, r };
+          gb_workqueue.push_front(replica);
+        }
+        pthread_cond_broadcast( &gb_workcond );
+        pthread_mutex_unlock( &gb_mutex );
+      }
+
+    } catch( const std::exception& e ) {
+      job.featstat[image_num] = FEAT_FAILED;
       logger( 0, "warning: failed extraction: %s", imgname.c_str() );
       logger( 0, "%s", e.what() );
     }
+
+    /// Finish the line unless replicas were queued, then the last one does ///
+    if( ! spawned )
+      releaseLine( job, image_num );
+
+    pthread_mutex_lock( &gb_mutex );
+    gb_numlines++;
+    gb_busytime[thread] += time_diff(busy_tm);
+    pthread_mutex_unlock( &gb_mutex );
+  }
+
+  pthread_exit((void*)0);
+}
+
+/**
+ * Writes the progress metrics file in Prometheus text format.
+ *
+ * @param uptime   Seconds since the start of the run.
+ * @param elapsed  Seconds since the previous update.
+ * @param prev     Values of the previous update, updated to the current ones.
+ */
+void writeMetrics( double uptime, double elapsed, vector<double>& prev ) {
+  int numthreads = gb_numthreads;
+  vector<double> curr( 3+numthreads );
+
+  pthread_mutex_lock( &gb_mutex );
+  curr[0] = gb_numlines;
+  for( int n=0; n<numthreads; n++ )
+    curr[3+n] = gb_busytime[n];
+  int workdepth = gb_workqueue.size();
+  int inflight = gb_inflight;
+  pthread_mutex_unlock( &gb_mutex );
+
+  pthread_mutex_lock( &gb_writemutex );
+  curr[2] = gb_writebytes;
+  int writedepth = gb_writequeue.size();
+  pthread_mutex_unlock( &gb_writemutex );
+
+  pthread_mutex_lock( &gb_jobmutex );
+  curr[1] = gb_numpages;
+  int jobsdepth = gb_jobs.size();
+  int numextract = gb_numextract;
+  int numskipped = gb_numskipped;
+  int numfailed = gb_numfailed;
+  pthread_mutex_unlock( &gb_jobmutex );
+
+  if( prev.size() != curr.size() )
+    prev.assign( curr.size(), 0.0 );
+
+  string tmpfile = string(gb_metricsfile)+".tmp";
+  FILE *file = fopen( tmpfile.c_str(), "w" );
+  if( file == NULL ) {
+    logger( 0, "warning: unable to write metrics: %s", tmpfile.c_str() );
+    return;
+  }
+
+  #define METRIC( name, type, help ) fprintf( file, "# HELP textfeats_" name " " help "\n# TYPE textfeats_" name " " type "\n" )
+  METRIC( "uptime_seconds", "gauge", "Time since the start of the run." );
+  fprintf( file, "textfeats_uptime_seconds %.1f\n", uptime );
+  METRIC( "lines_total", "counter", "Lines processed by the extraction threads." );
+  fprintf( file, "textfeats_lines_total %.0f\n", curr[0] );
+  METRIC( "lines_per_second", "gauge", "Lines processed per second since the previous update." );
+  fprintf( file, "textfeats_lines_per_second %.2f\n", (curr[0]-prev[0])/elapsed );
+  METRIC( "pages_total", "counter", "Page XMLs finished." );
+  fprintf( file, "textfeats_pages_total %.0f\n", curr[1] );
+  METRIC( "pages_per_second", "gauge", "Page XMLs finished per second since the previous update." );
+  fprintf( file, "textfeats_pages_per_second %.3f\n", (curr[1]-prev[1])/elapsed );
+  METRIC( "written_bytes_total", "counter", "Bytes of features and images written." );
+  fprintf( file, "textfeats_written_bytes_total %.0f\n", curr[2] );
+  METRIC( "samples_total", "counter", "Finalized samples by status." );
+  fprintf( file, "textfeats_samples_total{status=\"extracted\"} %d\n", numextract );
+  fprintf( file, "textfeats_samples_total{status=\"skipped\"} %d\n", numskipped );
+  fprintf( file, "textfeats_samples_total{status=\"failed\"} %d\n", numfailed );
+  METRIC( "queue_depth", "gauge", "Number of items waiting in each queue." );
+  fprintf( file, "textfeats_queue_depth{queue=\"jobs\"} %d\n", jobsdepth );
+  fprintf( file, "textfeats_queue_depth{queue=\"lines\"} %d\n", workdepth );
+  fprintf( file, "textfeats_queue_depth{queue=\"writes\"} %d\n", writedepth );
+  METRIC( "lines_in_process", "gauge", "Lines being processed by the extraction threads." );
+  fprintf( file, "textfeats_lines_in_process %d\n", inflight );
+  METRIC( "thread_busy_ratio", "gauge", "Fraction of time each extraction thread was busy since the previous update." );
+  for( int n=0; n<numthreads; n++ )
+    fprintf( file, "textfeats_thread_busy_ratio{thread=\"%d\"} %.3f\n", n, min(1.0,0.001*(curr[3+n]-prev[3+n])/elapsed) );
+  METRIC( "memory_rss_megabytes", "gauge", "Resident memory of the process." );
+  fprintf( file, "textfeats_memory_rss_megabytes %.1f\n", current_rss() );
+  METRIC( "memory_held_megabytes", "gauge", "Memory of the page and line images being held, as budgeted by --max-mem." );
+  fprintf( file, "textfeats_memory_held_megabytes %.1f\n", gb_heldbytes/1048576.0 );
+  #undef METRIC
+
+  fclose( file );
+  if( rename( tmpfile.c_str(), gb_metricsfile ) )
+    logger( 0, "warning: unable to write metrics: %s", gb_metricsfile );
+
+  prev = curr;
+}
+
+/**
+ * Function for periodically writing the progress metrics with pthread.
+ */
+void* metricsThread( void* ) {
+  chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+  chrono::high_resolution_clock::time_point last = start;
+  vector<double> prev;
+
+  pthread_mutex_lock( &gb_metricsmutex );
+  while( true ) {
+    struct timespec until;
+    clock_gettime( CLOCK_REALTIME, &until );
+    until.tv_sec += gb_metricsinterval;
+    while( ! gb_endmetrics )
+      if( pthread_cond_timedwait( &gb_metricscond, &gb_metricsmutex, &until ) == ETIMEDOUT )
+        break;
+    bool end = gb_endmetrics;
+    pthread_mutex_unlock( &gb_metricsmutex );
+
+    double elapsed = max( 0.001, 0.001*time_diff(last) );
+    last = chrono::high_resolution_clock::now();
+    writeMetrics( 0.001*time_diff(start), elapsed, prev );
+
+    if( end )
+      break;
+    pthread_mutex_lock( &gb_metricsmutex );
   }
 
   pthread_exit((void*)0);
 }
+
+/**
+ * Checks whether a line has annotations of the extraction.
+ */
+bool isAnnotatedLine( xmlNodePtr elem ) {
+  static const char *keys[] = { "rotation", "slope", "slant", "fpgram", "fcontour", "textFeats-failed", "textFeats-skipped", NULL };
+  for( xmlNodePtr child=elem->children; child!=NULL; child=child->next ) {
+    if( child->type != XML_ELEMENT_NODE || xmlStrcmp(child->name,(const xmlChar*)"Property") )
+      continue;
+    xmlChar *key = xmlGetProp( child, (const xmlChar*)"key" );
+    bool found = false;
+    for( int k=0; key!=NULL && keys[k]!=NULL && !found; k++ )
+      found = ! xmlStrcmp(key,(const xmlChar*)keys[k]);
+    xmlFree( key );
+    if( found )
+      return true;
+  }
+  return false;
+}
+
+/**
+ * Copies the annotations of the extraction of a line to the same line of another Page XML.
+ */
+void copyLineAnnotations( xmlNodePtr from, PageXML& page, xmlNodePtr to ) {
+  xmlNodePtr fromcoords = NULL;
+  xmlNodePtr tocoords = NULL;
+  for( xmlNodePtr child=to->children; child!=NULL; child=child->next )
+    if( child->type == XML_ELEMENT_NODE && ! xmlStrcmp(child->name,(const xmlChar*)"Coords") )
+      tocoords = child;
+
+  for( xmlNodePtr child=from->children; child!=NULL; child=child->next ) {
+    if( child->type != XML_ELEMENT_NODE )
+      continue;
+    if( ! xmlStrcmp(child->name,(const xmlChar*)"Coords") )
+      fromcoords = child;
+    if( xmlStrcmp(child->name,(const xmlChar*)"Property") )
+      continue;
+    xmlChar *key = xmlGetProp( child, (const xmlChar*)"key" );
+    xmlChar *value = xmlGetProp( child, (const xmlChar*)"value" );
+    if( key != NULL )
+      page.setProperty( to, (char*)key, (char*)value );
+    xmlFree( key );
+    xmlFree( value );
+  }
+
+  /// Feature contours stored in the points attribute ///
+  if( gb_fpoints && fromcoords != NULL && tocoords != NULL ) {
+    xmlChar *points = xmlGetProp( fromcoords, (const xmlChar*)"points" );
+    if( points != NULL )
+      xmlSetProp( tocoords, (const xmlChar*)"points", points );
+    xmlFree( points );
+  }
+}
+
+/**
+ * Merges the extraction XMLs of shards. For each XML file name found in the
+ * directories, the first directory (in the given order) that has it is the
+ * base, to which the line annotations of the other shards are added.
+ *
+ * @param dirs    Directories with the extraction XMLs of each shard.
+ * @param outdir  Directory where to write the merged XMLs.
+ * @return        SUCCESS or FAILURE.
+ */
+int mergeShards( vector<string>& dirs, string outdir ) {
+  if( ! file_exists(outdir.c_str()) )
+    die( "error: output directory does not exist: %s", outdir.c_str() );
+
+  /// Find XMLs of each shard, sorted by name ///
+  map<string,vector<string> > files;
+  for( int d=0; d<(int)dirs.size(); d++ ) {
+    DIR *dir = opendir( dirs[d].c_str() );
+    if( dir == NULL )
+      die( "error: unable to read directory: %s", dirs[d].c_str() );
+    struct dirent *ent;
+    while( ( ent = readdir(dir) ) != NULL )
+      if( regex_match(ent->d_name,gb_reXml) )
+        files[ent->d_name].push_back( dirs[d] );
+    closedir( dir );
+  }
+
+  string linexpath = string("(")+gb_xpath+")/..";
+  bool failure = false;
+  for( map<string,vector<string> >::iterator it=files.begin(); it!=files.end(); it++ ) {
+    string outfile = outdir+'/'+it->first;
+    logger( 1, "merging %d shards: %s", (int)it->second.size(), outfile.c_str() );
+    try {
+      PageXML base;
+      base.loadXml( (it->second[0]+'/'+it->first).c_str() );
+      map<string,xmlNodePt> lines;
+      vector<xmlNodePt> sel = base.select( linexpath.c_str() );
+      for( int k=0; k<(int)sel.size(); k++ )
+        lines[base.getAttr(sel[k],"id")] = sel[k];
+
+      for( int d=1; d<(int)it->second.size(); d++ ) {
+        PageXML shard;
+        shard.loadXml( (it->second[d]+'/'+it->first).c_str() );
+        sel = shard.select( linexpath.c_str() );
+        for( int k=0; k<(int)sel.size(); k++ ) {
+          if( ! isAnnotatedLine(sel[k]) )
+            continue;
+          string id = shard.getAttr(sel[k],"id");
+          map<string,xmlNodePt>::iterator line = lines.find(id);
+          if( line == lines.end() ) {
+            logger( 0, "error: line %s of %s not in %s", id.c_str(), it->second[d].c_str(), it->second[0].c_str() );
+            failure = true;
+            continue;
+          }
+          if( ! isAnnotatedLine(line->second) )
+            copyLineAnnotations( sel[k], base, line->second );
+        }
+      }
+
+      if( ! gb_overwrite && file_exists(outfile.c_str()) ) {
+        logger( 0, "error: aborted write to existing file: %s", outfile.c_str() );
+        failure = true;
+        continue;
+      }
+      base.write( outfile.c_str() );
+    } catch( const std::exception& e ) {
+      logger( 0, "error: failed to merge: %s", it->first.c_str() );
+      logger( 0, "%s", e.what() );
+      failure = true;
+    }
+  }
+
+  return failure ? FAILURE : SUCCESS;
+}
+
+/**
+ * Reads and decodes all records of archives, printing key, rows and cols of
+ * each, and reports the read throughput.
+ */
+int listArchives( vector<string>& fnames ) {
+  chrono::high_resolution_clock::time_point tm = chrono::high_resolution_clock::now();
+  long numrecs = 0;
+  double numbytes = 0.0;
+  double numvalues = 0.0;
+
+  for( int n=0; n<(int)fnames.size(); n++ ) {
+    FeatArchive archive;
+    try {
+      archive.openRead( fnames[n].c_str() );
+      vector<string> keys = archive.keys();
+      for( int k=0; k<(int)keys.size(); k++ ) {
+        cv::Mat feats;
+        archive.read( keys[k], feats );
+        fprintf( stdout, "%s %d %d\n", keys[k].c_str(), feats.rows, feats.cols );
+        numvalues += feats.total();
+      }
+      numrecs += keys.size();
+    }
+    catch( const std::exception& e ) {
+      die( "error: %s", e.what() );
+    }
+    struct stat st;
+    if( ! stat( fnames[n].c_str(), &st ) )
+      numbytes += st.st_size;
+  }
+
+  float ms = time_diff(tm);
+  logger( 1, "read %ld records, %.0f values, %.0f bytes in %.1f ms (%.0f records/s, %.1f MB/s)",
+    numrecs, numvalues, numbytes, ms, ms > 0 ? 1000.0*numrecs/ms : 0.0, ms > 0 ? 1000.0*numbytes/ms/1048576.0 : 0.0 );
+
+  return SUCCESS;
+}
@@ -0,0 +1,58 @@
+/**
+ * C interface for in-memory batch extraction of text features
+ *
+ * Plain C functions around the BatchExtractor class, for use from other
+ * languages, e.g. Python ctypes or pybind. All functions return 0 on success
+ * and -1 on failure, in which case tf_last_error gives the reason. Batches
+ * must be released with tf_batch_free.
+ *
+ * @version $Version: 2026.10.17$
+ * @copyright Copyright (c) 2016-present, Mauricio Villegas <mauricio_ville@yahoo.com>
+ * @license MIT License
+ */
+
+#ifndef __TEXTFEATSBATCH_H__
+#define __TEXTFEATSBATCH_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct tf_extractor tf_extractor;
+
+/**
+ * Features of a batch. With padding, the features of sample n are at
+ * data+n*maxwidth*dim, otherwise at data+offsets[n]; in both cases width[n]
+ * frames of dim values each.
+ */
+typedef struct {
+  int num;                 /* Number of samples */
+  int dim;                 /* Feature vector dimensionality */
+  int maxwidth;            /* Frames of the widest sample */
+  int padded;              /* Whether samples are zero padded to maxwidth */
+  float *data;             /* Features of all samples */
+  long *offsets;           /* Offset of each sample in data, in floats */
+  int *widths;             /* Number of frames of each sample */
+  int *ok;                 /* Whether the extraction of each sample succeeded */
+  char **ids;              /* Id of each sample */
+  float *slopes;           /* Estimated slope of each sample */
+  float *slants;           /* Estimated slant of each sample */
+  float *fpgrams;          /* Features parallelogram of each sample, 4 x,y points (with info) */
+  int *contour_offsets;    /* Start of each sample's contour in contours, num+1 values (with info) */
+  int *contours;           /* Features contours as x,y pairs (with info) */
+} tf_batch;
+
+const char* tf_last_error( void );
+tf_extractor* tf_create( const char* cfgfile, int threads );
+void tf_destroy( tf_extractor* tf );
+int tf_set_info( tf_extractor* tf, int info );
+int tf_set_random( tf_extractor* tf, int randomize, unsigned long long seed );
+int tf_extract_gray( tf_extractor* tf, int num, const unsigned char** pixels, const int* widths, const int* heights, const int* strides, int pad, tf_batch* batch );
+int tf_extract_page( tf_extractor* tf, const char* xml, const char* xpath, int xmlstring, int pad, tf_batch* batch );
+void tf_batch_free( tf_batch* batch );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
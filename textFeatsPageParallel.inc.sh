@@ -22,56 +22,48 @@ textFeatsPageParallel () {(
         n=$((n+1));
         XPATH="${!n}";
         ;;
+      "--savexml")
+        SAVEXML="";
+        ;;
+      "--savexml="*)
+        SAVEXML="${!n#--savexml=}";
+        ;;
       *)
         ARGS+=( "${!n}" );
         ;;
     esac
-    [ "${!n:0:10}" = "--savexml" ] && SAVEXML="${!n:10}";
     n=$((n+1));
   done
 
   local XML="${!#}";
   local NUMLINES=$(xmlstarlet sel -t -v "count($XPATH)" "$XML");
   [ "$NUMLINES" = "" ] && return 1;
+  [ "$THREADS" -gt "$NUMLINES" ] && THREADS="$NUMLINES";
+  [ "$THREADS" -lt 1 ] && THREADS="1";
+  local LST=$(seq -s , 0 $((THREADS-1)));
 
-  local LST=$( awk -v NLIST=$NUMLINES -v NTHREADS=$THREADS '
-    function ceil(v) { return int(v) + (v == int(v) ? 0 : 1); }
-    BEGIN {
-      fact = ceil(NLIST/NTHREADS);
-      while( fact < 2 && NTHREADS > 1 ) {
-        NTHREADS--;
-        fact = ceil(NLIST/NTHREADS);
-      }
-      if ( NTHREADS == 1 )
-        printf( "1-%d\n", NLIST );
-      else {
-        n = 0;
-        while( n < NLIST ) {
-          nxt = n+fact;
-          printf( "%s%d-%d", n==0?"":",", n+1, ( nxt < NLIST ? nxt : NLIST ) );
-          n = nxt;
-        }
-        printf("\n");
-      }
-    }' );
-
+  local SHARDS=$(mktemp -d --tmpdir="$OUTDIR" extract_feats_XXXXX);
   extract_feats () {
-    local RNG=( ${1/-/ } );
-    local LARGS=( "${ARGS[@]}" --outdir "$OUTDIR" --xpath "($XPATH)[position() >= ${RNG[0]} and not(position() > ${RNG[1]})]" );
+    local LARGS=( "${ARGS[@]}" --outdir "$OUTDIR" --xpath "$XPATH" --shard "$1/$THREADS:line" );
     [ "$SAVEXML" != "-" ] &&
-      local TMP=$(mktemp -d --tmpdir="$OUTDIR" extract_feats_XXXXX) &&
-      LARGS+=( --savexml="$TMP" );
-    { textFeats "${LARGS[@]}" "$XML";
-      [ "$?" != 0 ] && return 1;
-    } | sed "s|/extract_feats_...../|/|";
-    #if [ -f $(echo "$XML" | sed 's|.*/||; s|^|'"$TMP"/'|;') ]; then
-    #fi
-    #[ "$SAVEXML" != "-" ] &&
-      rmdir -r "$TMP";
-    return 0;
+      mkdir "$SHARDS/$1" &&
+      LARGS+=( --savexml="$SHARDS/$1" );
+    textFeats "${LARGS[@]}" "$XML";
   }
 
   local TMPDIR="$OUTDIR";
   run_parallel -T "$THREADS" -l "$LST" -p no \
     extract_feats '{*}';
+  local RC="$?";
+
+  ### Merge the extraction XMLs of the shards ###
+  if [ "$RC" = 0 ] && [ "$SAVEXML" != "-" ]; then
+    local MARGS=( --merge --xpath "$XPATH" --outdir "$OUTDIR" );
+    [ "$SAVEXML" != "" ] && MARGS+=( --savexml="$SAVEXML" );
+    printf "%s\n" "${ARGS[@]}" | grep -qx -- '--overwrite' && MARGS+=( --overwrite );
+    textFeats "${MARGS[@]}" $(seq -f "$SHARDS/%g" 0 $((THREADS-1)));
+    RC="$?";
+  fi
+  rm -r "$SHARDS";
+  return "$RC";
 )}